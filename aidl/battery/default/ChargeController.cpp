@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "ChargeController.h"
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+int64_t SteadyClock::nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void ChargeController::reset() {
+  current = ChargeStatus::NOOP;
+  applied = false;
+  delay = policy.min;
+  predictor.reset();
+}
+
+void ChargeController::restore(ChargeStatus status) {
+  reset();
+  current = status;
+  applied = status != ChargeStatus::NOOP;
+}
+
+int ChargeController::step(const ChargeConfig& cfg, int capacity) {
+  ChargeStatus next;
+
+  if (capacity < 0)
+    capacity = source.readCapacity();
+  if (capacity < 0)
+    return capacity;
+  if (capacity > cfg.upper)
+    next = ChargeStatus::OFF;
+  else if (cfg.restart && capacity < cfg.lower)
+    next = ChargeStatus::ON;
+  else if (!cfg.restart && capacity <= cfg.upper - 1)
+    next = ChargeStatus::ON;
+  else
+    next = ChargeStatus::NOOP;
+  if (next != current || !applied) {
+    switch (next) {
+    case ChargeStatus::OFF:
+      chargeSwitch.setChargable(false);
+      ++toggleCount;
+      break;
+    case ChargeStatus::ON:
+      chargeSwitch.setChargable(true);
+      ++toggleCount;
+      break;
+    default:
+      break;
+    }
+    // The rate changes with the charger state, start over
+    predictor.reset();
+    current = next;
+    applied = true;
+  }
+  if (!policy.predict)
+    return capacity;
+
+  // Capacity range keeping the current decision
+  const int low = current == ChargeStatus::ON ? 0 : (cfg.restart ? cfg.lower : cfg.upper);
+  const int high = current == ChargeStatus::OFF ? 100 : cfg.upper;
+
+  predictor.addSample(clock.nowMs(), capacity);
+  delay = predictor.nextWakeup(capacity, low, high, policy.min, policy.max);
+  return capacity;
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
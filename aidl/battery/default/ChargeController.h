@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "ChargePredictor.h"
+
+#include <chrono>
+#include <cstdint>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+// Immutable once published, replaced as a whole
+struct ChargeConfig {
+  int upper = -1, lower = -1;
+  bool restart = false;
+};
+
+enum ChargeStatus {
+  ON,
+  OFF,
+  NOOP,
+};
+
+// Returns the battery level in percent, or a negative error
+class CapacitySource {
+ public:
+  virtual ~CapacitySource() = default;
+  virtual int readCapacity() = 0;
+};
+
+class ChargeSwitch {
+ public:
+  virtual ~ChargeSwitch() = default;
+  virtual void setChargable(bool enable) = 0;
+};
+
+class Clock {
+ public:
+  virtual ~Clock() = default;
+  // Monotonic
+  virtual int64_t nowMs() = 0;
+};
+
+class SteadyClock : public Clock {
+ public:
+  int64_t nowMs() override;
+};
+
+// How long to wait between capacity reads, when nothing else wakes the loop
+struct PollPolicy {
+  // Use ChargePredictor, else always poll at [min]
+  bool predict;
+  std::chrono::milliseconds min, max;
+};
+
+/**
+ * The charge control decisions of SmartCharge, without binder, properties or
+ * the health HAL, so policies can be run on host against a simulated battery.
+ * Not thread safe, owned by the loop.
+ */
+class ChargeController {
+ public:
+  ChargeController(CapacitySource& source, ChargeSwitch& chargeSwitch, Clock& clock,
+                   PollPolicy policy)
+      : source(source), chargeSwitch(chargeSwitch), clock(clock), policy(policy) {}
+
+  // Start over, the next decision is applied even if unchanged
+  void reset();
+  // Carry on from [status], assumed to be applied already. NOOP is the same as reset().
+  void restore(ChargeStatus status);
+  /**
+   * Decide on the capacity under [cfg], switching charging if the decision
+   * changed.
+   *
+   * @param cfg Limits to apply
+   * @param capacity Capacity already known, such as from an event, or -1 to
+   *                 read it from the source
+   * @return The capacity used, or the negative error of the source, in which
+   *         case nothing was decided
+   */
+  int step(const ChargeConfig& cfg, int capacity = -1);
+
+  ChargeStatus status() const { return current; }
+  std::chrono::milliseconds pollDelay() const { return delay; }
+  uint64_t toggles() const { return toggleCount; }
+
+ private:
+  CapacitySource& source;
+  ChargeSwitch& chargeSwitch;
+  Clock& clock;
+  const PollPolicy policy;
+  ChargePredictor predictor;
+
+  ChargeStatus current = ChargeStatus::NOOP;
+  bool applied = false;
+  std::chrono::milliseconds delay = policy.min;
+  uint64_t toggleCount = 0;
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "ChargePredictor.h"
+
+#include <algorithm>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+// Wake up this fraction of the predicted time early
+static constexpr double kWakeupMargin = 0.75;
+// Samples must span this much time for a usable estimate
+static constexpr int64_t kMinSpanMs = 30 * 1000;
+// Closer samples replace the newest one, or fast polling would fill the ring
+// with a single capacity step
+static constexpr int64_t kMinGapMs = 30 * 1000;
+
+void ChargePredictor::addSample(int64_t timeMs, int capacity) {
+  if (count >= 2) {
+    const size_t last = (head + kMaxSamples - 1) % kMaxSamples;
+    const size_t prev = (head + kMaxSamples - 2) % kMaxSamples;
+    if (timeMs - samples[prev].timeMs < kMinGapMs) {
+      samples[last] = {timeMs, capacity};
+      return;
+    }
+  }
+  samples[head] = {timeMs, capacity};
+  head = (head + 1) % kMaxSamples;
+  count = std::min(count + 1, kMaxSamples);
+}
+
+void ChargePredictor::reset() {
+  head = count = 0;
+}
+
+size_t ChargePredictor::first() const {
+  return (head + kMaxSamples - count) % kMaxSamples;
+}
+
+bool ChargePredictor::hasEstimate() const {
+  if (count < 2)
+    return false;
+  return samples[(head + kMaxSamples - 1) % kMaxSamples].timeMs - samples[first()].timeMs >=
+         kMinSpanMs;
+}
+
+double ChargePredictor::rate() const {
+  double sumT = 0, sumC = 0, sumTT = 0, sumTC = 0;
+
+  if (!hasEstimate())
+    return 0;
+  // Relative to the oldest sample, keeps the sums small
+  const int64_t t0 = samples[first()].timeMs;
+  for (size_t i = 0; i < count; ++i) {
+    const auto& s = samples[(first() + i) % kMaxSamples];
+    const double t = (s.timeMs - t0) / 60000.0;
+    sumT += t;
+    sumC += s.capacity;
+    sumTT += t * t;
+    sumTC += t * s.capacity;
+  }
+  const double denom = count * sumTT - sumT * sumT;
+  return denom > 0 ? (count * sumTC - sumT * sumC) / denom : 0;
+}
+
+std::chrono::milliseconds ChargePredictor::nextWakeup(int capacity, int low, int high,
+                                                      std::chrono::milliseconds min,
+                                                      std::chrono::milliseconds max) const {
+  const double r = rate();
+  double minutes;
+
+  if (!hasEstimate() || capacity < low || capacity > high)
+    return min;
+  // Already at the edge it is heading to, the next step may be due any time
+  if ((r >= 0 && capacity == high) || (r <= 0 && capacity == low))
+    return min;
+  // Capacity is reported in 1% steps, the last step may be almost done already
+  if (r > 0)
+    minutes = (high - capacity) / r;
+  else if (r < 0)
+    minutes = (capacity - low) / -r;
+  else
+    return max;
+  auto wakeup = std::chrono::milliseconds(static_cast<int64_t>(minutes * kWakeupMargin * 60000));
+  return std::clamp(wakeup, min, max);
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+/**
+ * Estimates the charge rate from recent capacity samples, by a least squares
+ * fit over a small ring of them, and when the capacity crosses a threshold.
+ * No Android dependencies, so it builds for host as well.
+ */
+class ChargePredictor {
+ public:
+  static constexpr size_t kMaxSamples = 8;
+
+  // Add a capacity sample taken at [timeMs], any monotonic time base
+  void addSample(int64_t timeMs, int capacity);
+  void reset();
+
+  // True once the samples span enough time to estimate the rate
+  bool hasEstimate() const;
+  // Estimated rate in percent per minute, negative while discharging. 0 if unknown.
+  double rate() const;
+
+  /**
+   * Time to sleep before the next check, so it happens right before the
+   * capacity leaves [low, high]. Without an estimate it returns [min].
+   *
+   * @param capacity Current capacity
+   * @param low Capacity below this is a crossing
+   * @param high Capacity above this is a crossing
+   * @param min Lower bound of the result
+   * @param max Upper bound of the result
+   */
+  std::chrono::milliseconds nextWakeup(int capacity, int low, int high,
+                                       std::chrono::milliseconds min,
+                                       std::chrono::milliseconds max) const;
+
+ private:
+  struct Sample {
+    int64_t timeMs;
+    int capacity;
+  };
+  size_t first() const;
+  std::array<Sample, kMaxSamples> samples{};
+  // Index of the next sample to write, and number of valid ones
+  size_t head = 0, count = 0;
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
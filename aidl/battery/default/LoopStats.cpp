@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "LoopStats.h"
+
+#include <cinttypes>
+#include <cstdio>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+void LatencyStats::add(uint64_t wall, uint64_t cpu) {
+  const uint64_t us = wall / 1000;
+  size_t bucket = 0;
+
+  while (bucket < kBuckets - 1 && us >= (1ULL << bucket))
+    ++bucket;
+  ++count;
+  wallNs += wall;
+  cpuNs += cpu;
+  ++buckets[bucket];
+  uint64_t max = maxNs.load(std::memory_order_relaxed);
+  while (wall > max && !maxNs.compare_exchange_weak(max, wall, std::memory_order_relaxed))
+    ;
+}
+
+uint64_t LatencyStats::percentileUs(unsigned percent) const {
+  uint64_t total = 0, seen = 0;
+
+  for (const auto& b : buckets)
+    total += b;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets[i];
+    if (seen * 100 >= total * percent)
+      return 1ULL << i;
+  }
+  return 1ULL << (kBuckets - 1);
+}
+
+void LatencyStats::dump(int fd, const char* name) const {
+  const uint64_t n = count;
+
+  if (n == 0)
+    return;
+  dprintf(fd, "%s: %" PRIu64 ", avg %" PRIu64 " us, cpu %" PRIu64 " us, p50 <%" PRIu64
+          " us, p99 <%" PRIu64 " us, max %" PRIu64 " us\n",
+          name, n, wallNs / n / 1000, cpuNs / n / 1000, percentileUs(50), percentileUs(99),
+          maxNs / 1000);
+}
+
+// Seconds in the upper 40 bits, then status, capacity and a valid bit
+void CapacityHistory::add(int64_t timeMs, int capacity, int status) {
+  const uint64_t entry = (static_cast<uint64_t>(timeMs / 1000) << 24) |
+                         (static_cast<uint64_t>(status & 0xff) << 16) |
+                         (static_cast<uint64_t>(capacity & 0xff) << 8) | 1;
+  const uint64_t i = next.load(std::memory_order_relaxed);
+
+  entries[i % kSize].store(entry, std::memory_order_relaxed);
+  next.store(i + 1, std::memory_order_release);
+}
+
+void CapacityHistory::dump(int fd, int64_t nowMs, const char* const* statusNames) const {
+  const uint64_t end = next.load(std::memory_order_acquire);
+  const uint64_t begin = end > kSize ? end - kSize : 0;
+
+  for (uint64_t i = begin; i < end; ++i) {
+    const uint64_t entry = entries[i % kSize].load(std::memory_order_relaxed);
+    if (!(entry & 1))
+      continue;
+    dprintf(fd, "  -%" PRId64 "s: %d%% %s\n",
+            nowMs / 1000 - static_cast<int64_t>(entry >> 24),
+            static_cast<int>((entry >> 8) & 0xff), statusNames[(entry >> 16) & 0xff]);
+  }
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+// Count, totals and a log2 histogram of a latency. Lock-free, safe to dump
+// while being added to, at worst a dump mixes two updates.
+struct LatencyStats {
+  // Bucket i holds latencies below 2^i us, the last one everything above
+  static constexpr size_t kBuckets = 16;
+  std::atomic_uint64_t count = 0, wallNs = 0, cpuNs = 0, maxNs = 0;
+  std::array<std::atomic_uint64_t, kBuckets> buckets{};
+
+  void add(uint64_t wall, uint64_t cpu);
+  // Upper bound in us of the bucket holding the given percentile
+  uint64_t percentileUs(unsigned percent) const;
+  // One line, nothing if empty
+  void dump(int fd, const char* name) const;
+};
+
+// Capacity and status whenever either changed, last kSize of them.
+// One writer, any number of readers.
+class CapacityHistory {
+ public:
+  static constexpr size_t kSize = 64;
+
+  void add(int64_t timeMs, int capacity, int status);
+  // Oldest first, with times relative to [nowMs]
+  void dump(int fd, int64_t nowMs, const char* const* statusNames) const;
+
+ private:
+  // Packed entries, written whole so readers never see a torn one
+  std::array<std::atomic_uint64_t, kSize> entries{};
+  std::atomic_uint64_t next = 0;
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
@@ -13,8 +13,17 @@
 #include <hidl/HidlTransportSupport.h>
 #include <log/log.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 #include <functional>
 #include <sstream>
 #include <type_traits>
@@ -34,10 +43,31 @@ using ScopedLock = const std::lock_guard<std::mutex>;
 using namespace std::chrono_literals;
 
 static constexpr int kInvalidCfg = -1;
+// Without health HAL callbacks, capacity is polled within these bounds,
+// depending on how soon the predicted charge rate reaches a limit
+static constexpr PollPolicy kPollPolicy = {true, 5s, 60s};
+// With callbacks, in case an event gets lost while charging
+static constexpr auto kFallbackInterval = 60s;
+// Health HAL reconnection backoff
+static constexpr std::chrono::milliseconds kReconnectMinDelay = 500ms;
+static constexpr std::chrono::milliseconds kReconnectMaxDelay = 60s;
+// Capacity read result while the health HAL is unreachable
+static constexpr int kHalUnavailable = INT_MIN;
 
 static const char kSmartChargeConfigProp[] = "persist.ext.smartcharge.config";
 static const char kSmartChargeEnabledProp[] = "persist.ext.smartcharge.enabled";
 static const char kSmartChargeOverrideProp[] = "ro.hardware.battery";
+// On tmpfs, created by init. Outlives the service, but not a reboot.
+static const char kSmartChargeStatePath[] = "/dev/smartcharge/state";
+// Capacity sysfs node to read instead of the health HAL, empty to disable.
+// Such as /sys/class/power_supply/battery/capacity
+static const char kSmartChargeCapacityNodeProp[] = "persist.ext.smartcharge.capacity_node";
+// Every Nth sysfs read is compared against the health HAL
+static constexpr uint64_t kCrossCheckEvery = 20;
+// Tolerated difference, the HAL may round or report a bit later
+static constexpr int kCrossCheckSlack = 1;
+// Give up on the node after this many mismatches
+static constexpr uint64_t kMaxMismatches = 3;
 static const char kComma = ',';
 
 template <typename T>
@@ -86,9 +116,10 @@ bool fromString(const std::string &v, ConfigPair<bool> *pair) {
   return false;
 }
 
+// Without [wait], a property not created yet is taken as missing
 template <typename U>
-bool getAndParse(const char *prop, ConfigPair<U> *pair) {
-  if (WaitForPropertyCreation(prop, 500ms)) {
+bool getAndParse(const char *prop, ConfigPair<U> *pair, bool wait = true) {
+  if (!wait || WaitForPropertyCreation(prop, 500ms)) {
     std::string propval = GetProperty(prop, "");
     if (!propval.empty()) {
       return fromString(propval, pair);
@@ -100,31 +131,32 @@ bool getAndParse(const char *prop, ConfigPair<U> *pair) {
 const static auto kDisabledCfgStr = ConfigPair<bool>{0, 0}.toString();
 
 static void onServiceDied(void *cookie) {
-  reinterpret_cast<SmartCharge *>(cookie)->loadHealthImpl();
+  // Death notification thread, don't block it
+  reinterpret_cast<SmartCharge *>(cookie)->startHealthReconnect();
 }
 
-void SmartCharge::loadHealthImpl(void) {
+bool SmartCharge::connectHealth(void) {
+  const auto kAidlInstance = std::string() + IHealthAIDL::descriptor + "/default";
+  std::shared_ptr<IHealthAIDL> aidl;
+  sp<IHealth> hidl;
   bool linkToDeathSuccess;
   std::string reason;
-  ScopedLock _(hal_health_lock);
 
-  // Try aidl
-  health_aidl = waitServiceDefault<IHealthAIDL>();
-  if (health_aidl == nullptr) {
-    // hidl
-    health_hidl = ::android::hardware::health::V2_0::get_health_service();
-    if (health_hidl != nullptr) {
-      healthState = USE_HEALTH_HIDL;
-      ALOGD("%s: Connected to health HIDL V2.0 HAL", __func__);
-      hidl_death_recp = new hidl_health_death_recipient(health_hidl);
-      auto ret = health_hidl->linkToDeath(hidl_death_recp, reinterpret_cast<uint64_t>(this));
-      linkToDeathSuccess = ret.isOk();
-      reason = ret.description();
-    } else {
-      LOG_ALWAYS_FATAL("Failed to connect to any valid health HAL");
-      __builtin_unreachable();
-    }
+  // Lookups may block, keep them outside of the lock.
+  // A declared AIDL HAL is waited for, rather than falling back to HIDL.
+  if (AServiceManager_isDeclared(kAidlInstance.c_str())) {
+    aidl = getServiceDefault<IHealthAIDL>();
+    if (aidl == nullptr)
+      return false;
   } else {
+    hidl = ::android::hardware::health::V2_0::get_health_service();
+    if (hidl == nullptr)
+      return false;
+  }
+
+  ScopedLock _(hal_health_lock);
+  if (aidl) {
+    health_aidl = aidl;
     healthState = USE_HEALTH_AIDL;
     ALOGD("%s: Connected to health AIDL HAL", __func__);
     aidl_death_recp = ndk::ScopedAIBinder_DeathRecipient(
@@ -133,21 +165,173 @@ void SmartCharge::loadHealthImpl(void) {
     auto ret = AIBinder_linkToDeath(health_aidl->asBinder().get(), aidl_death_recp.get(), this);
     linkToDeathSuccess = ret == STATUS_OK;
     reason = ndk::ScopedAStatus(AStatus_fromStatus(ret)).getDescription();
+  } else {
+    health_hidl = hidl;
+    healthState = USE_HEALTH_HIDL;
+    ALOGD("%s: Connected to health HIDL V2.0 HAL", __func__);
+    hidl_death_recp = new hidl_health_death_recipient(health_hidl);
+    auto ret = health_hidl->linkToDeath(hidl_death_recp, reinterpret_cast<uint64_t>(this));
+    linkToDeathSuccess = ret.isOk();
+    reason = ret.description();
   }
   if (!linkToDeathSuccess)
     ALOGW("%s: linkToDeath failed: %s", __func__, reason.c_str());
+  registerHealthCallback();
+  return true;
+}
+
+void SmartCharge::startHealthReconnect(void) {
+  if (kReconnecting.exchange(true))
+    return;
+  {
+    ScopedLock _(hal_health_lock);
+    healthState = UNKNOWN;
+    healthCallbackRegistered = false;
+    health_aidl.reset();
+    health_hidl.clear();
+  }
+  // The previous one has finished, as kReconnecting was false
+  ScopedLock _(reconnect_lock);
+  if (kStopReconnect)
+    return;
+  if (kReconnectThread.joinable())
+    kReconnectThread.join();
+  kReconnectThread = std::thread(&SmartCharge::reconnectHealth, this);
+}
+
+void SmartCharge::reconnectHealth(void) {
+  const auto start = std::chrono::steady_clock::now();
+  auto delay = kReconnectMinDelay;
+
+  ALOGW("%s: Health HAL is gone, reconnecting", __func__);
+  while (!connectHealth()) {
+    ALOGW("%s: No health HAL, retrying in %lldms", __func__,
+          static_cast<long long>(delay.count()));
+    std::unique_lock<std::mutex> lock(reconnect_lock);
+    // kReconnecting stays set, so that no other reconnect starts
+    if (reconnectCv.wait_for(lock, delay, [this] { return kStopReconnect; })) {
+      ALOGI("%s: Stopped", __func__);
+      return;
+    }
+    delay = std::min(delay * 2, kReconnectMaxDelay);
+  }
+  const uint64_t took = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  ALOGI("%s: Reconnected in %" PRIu64 "ms", __func__, took);
+  lastReconnectMs = took;
+  totalReconnectMs += took;
+  ++halReconnects;
+  kReconnecting = false;
+  // Let the loop read a fresh value
+  if (kRunning)
+    notifyLoop();
+}
+
+// Must hold hal_health_lock
+void SmartCharge::registerHealthCallback(void) {
+  bool registered = false;
+  std::string reason;
+
+  switch (healthState) {
+  case USE_HEALTH_AIDL: {
+    if (!aidl_info_callback)
+      aidl_info_callback = ndk::SharedRefBase::make<aidl_health_info_callback>(this);
+    auto ret = health_aidl->registerCallback(aidl_info_callback);
+    registered = ret.isOk();
+    reason = ret.getDescription();
+    break;
+  }
+  case USE_HEALTH_HIDL: {
+    using ::android::hardware::health::V2_0::Result;
+
+    if (!hidl_info_callback)
+      hidl_info_callback = new hidl_health_info_callback(this);
+    auto ret = health_hidl->registerCallback(hidl_info_callback);
+    if (ret.isOk()) {
+      Result res = ret;
+      registered = res == Result::SUCCESS;
+      reason = toString(res);
+    } else {
+      reason = ret.description();
+    }
+    break;
+  }
+  default:
+    break;
+  }
+  // Both HALs report the current state right after registration
+  healthCallbackRegistered = registered;
+  if (registered)
+    ALOGD("%s: Registered health info callback", __func__);
+  else
+    ALOGW("%s: Failed to register health info callback, polling: %s", __func__, reason.c_str());
+}
+
+void SmartCharge::onHealthInfoChanged(int capacity, bool online) {
+  const bool wasOnline = chargerOnline.exchange(online);
+  const int lastCap = lastCapacity.exchange(capacity);
+
+  ++healthEvents;
+  // HAL also reports temperature, voltage etc changes, only these matter
+  if (capacity == lastCap && online == wasOnline)
+    return;
+  // Nothing to control while unplugged
+  if (!kRunning || (!online && !wasOnline))
+    return;
+  notifyLoop();
+}
+
+void SmartCharge::notifyLoop(void) {
+  {
+    ScopedLock _(kCVLock);
+    kEventPending = true;
+  }
+  cv.notify_one();
+}
+
+bool SmartCharge::updateConfig(const std::function<bool(ChargeConfig&)>& fn) {
+  auto cur = std::atomic_load(&config);
+  std::shared_ptr<const ChargeConfig> next;
+
+  // Retry if someone else published in between, so no update gets lost and
+  // [fn] always checks the config it replaces
+  do {
+    auto copy = *cur;
+    if (!fn(copy))
+      return false;
+    next = std::make_shared<const ChargeConfig>(copy);
+  } while (!std::atomic_compare_exchange_weak(&config, &cur, next));
+  ++configUpdates;
+  if (kRunning)
+    notifyLoop();
+  notifyStatusChanged();
+  return true;
+}
+
+// Restart mode needs a lower limit
+static bool setRestart(ChargeConfig& c, bool restart) {
+  if (restart && c.lower == kInvalidCfg)
+    return false;
+  c.restart = restart;
+  return true;
 }
 
 bool SmartCharge::loadAndParseConfigProp(void) {
   ConfigPair<int> ret{};
   if (getAndParse(kSmartChargeConfigProp, &ret) &&
       verifyConfig(ret.first, ret.second)) {
-    upper = ret.second;
-    lower = ret.first;
-    ALOGD("%s: upper: %d, lower: %d", __func__, upper, lower);
+    updateConfig([&ret](ChargeConfig& c) {
+      c.upper = ret.second;
+      c.lower = ret.first;
+      return true;
+    });
+    ALOGD("%s: upper: %d, lower: %d", __func__, ret.second, ret.first);
   } else {
-    upper = -1;
-    lower = -1;
+    updateConfig([](ChargeConfig& c) {
+      c.upper = -1;
+      c.lower = -1;
+      return true;
+    });
     ALOGW("%s: Parsing config failed", __func__);
     return false;
   }
@@ -168,15 +352,45 @@ void SmartCharge::loadImplLibrary(void) {
   ALOGI("%s: Try dlopen '%s'", __func__, path.c_str());
   handle = dlopen(path.c_str(), RTLD_NOW);
   if (handle) {
-    setChargableFunc = reinterpret_cast<void(*)(const bool)>(
-        dlsym(handle, "setChargable"));
-
-    if (setChargableFunc) {
-      ALOGD("%s: setChargable function loaded", __func__);
+    // v2 modules export a versioned struct, v1 modules a single function
+    module = reinterpret_cast<const battery_module*>(dlsym(handle, BATTERY_MODULE_SYM));
+    if (module && module->version < BATTERY_MODULE_API_VERSION_2) {
+      ALOGE("%s: Unsupported module version %u", __func__, module->version);
+      module = nullptr;
+    }
+    if (module && module->init) {
+      int rc = module->init();
+      if (rc < 0) {
+        ALOGE("%s: Module init failed: %s", __func__, strerror(-rc));
+        module = nullptr;
+      }
+    }
+    if (module) {
+      moduleCaps = module->getCaps ? module->getCaps() & module->caps : module->caps;
+      ALOGD("%s: Module v%u loaded, caps 0x%x of 0x%x", __func__, module->version, moduleCaps,
+            module->caps);
+      if (moduleCaps != module->caps)
+        ALOGW("%s: Module caps 0x%x unavailable on this device", __func__,
+              module->caps & ~moduleCaps);
+      if ((moduleCaps & BATTERY_CAP_CHARGE_CONTROL) && module->setChargable) {
+        setChargableFunc = [m = module](const bool enable) {
+          int rc = m->setChargable(enable);
+          if (rc < 0)
+            ALOGE("setChargable(%d) failed: %s", enable, strerror(-rc));
+        };
+      }
     } else {
+      setChargableFunc = reinterpret_cast<void(*)(const bool)>(
+          dlsym(handle, "setChargable"));
+      if (setChargableFunc)
+        ALOGD("%s: setChargable function loaded", __func__);
+    }
+
+    if (!module && !setChargableFunc) {
       ALOGE("%s: Failed to find setChargable symbol", __func__);
       // Unused handle, close it
       dlclose(handle);
+      handle = nullptr;
     }
   } else {
     ALOGE("%s: %s", __func__, dlerror() ?: "unknown");
@@ -190,177 +404,746 @@ void SmartCharge::loadEnabledAndStart(void) {
   ConfigPair<bool> ret{};
 
   if (getAndParse(kSmartChargeEnabledProp, &ret)) {
-    if (ret.first) {
+    ScopedLock _(thread_lock);
+    if (ret.first && kRunning) {
+      ALOGD("%s: Loop already running from saved state", __func__);
+    } else if (ret.first) {
       ALOGD("%s: Starting loop, withrestart: %d", __func__, ret.second);
-      createLoopThread(ret.second);
+      if (!createLoopThread(ret.second)) {
+        ALOGE("%s: Restart mode without a lower limit, disabling", __func__);
+        SetProperty(kSmartChargeEnabledProp, kDisabledCfgStr);
+      }
+    } else if (kRunning || restoredStatus != ChargeStatus::NOOP) {
+      ALOGD("%s: Undoing saved state, not enabled", __func__);
+      stopLoop();
     } else
       ALOGD("%s: Not starting loop", __func__);
   } else {
     ALOGE("%s: Enabled prop value invalid, resetting to valid one", __func__);
     SetProperty(kSmartChargeEnabledProp, kDisabledCfgStr);
+    ScopedLock _(thread_lock);
+    if (kRunning || restoredStatus != ChargeStatus::NOOP)
+      stopLoop();
   }
 }
 
-SmartCharge::SmartCharge(void) {
+SmartCharge::~SmartCharge(void) {
+  if (kInitThread.joinable())
+    kInitThread.join();
+  {
+    ScopedLock _(reconnect_lock);
+    kStopReconnect = true;
+  }
+  reconnectCv.notify_one();
+  // Not replaced from now on, see startHealthReconnect()
+  if (kReconnectThread.joinable())
+    kReconnectThread.join();
+  {
+    ScopedLock _(callback_lock);
+    kStopCallbacks = true;
+  }
+  callbackCv.notify_one();
+  if (kCallbackThread.joinable())
+    kCallbackThread.join();
+  if (module && module->deinit)
+    module->deinit();
+  if (capacityFd >= 0)
+    close(capacityFd);
+}
+
+SmartCharge::SmartCharge(void)
+    : controller(*this, *this, steadyClock, kPollPolicy), stateStore(kSmartChargeStatePath) {}
+
+void SmartCharge::initAsync(void) {
+  kInitThread = std::thread(&SmartCharge::initialize, this);
+}
+
+void SmartCharge::initialize(void) {
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::function<void()>> calls;
   bool ret;
 
-  loadHealthImpl();
-  loadImplLibrary();
+  {
+    ScopedLock _(init_lock);
+    initThreadId = std::this_thread::get_id();
+  }
+  // First, as it may get the loop going before the health HAL is there
+  kRestored = restoreState();
+  // Keep initializing without it, the loop copes until it is back
+  if (!connectHealth())
+    startHealthReconnect();
+  if (!kRestored) {
+    loadImplLibrary();
+    selectCapacitySource();
+  }
 
+  // Properties have the final say over the saved state
   ret = loadAndParseConfigProp();
   if (ret) {
     loadEnabledAndStart();
+  } else if (kRunning || restoredStatus != ChargeStatus::NOOP) {
+    ScopedLock _(thread_lock);
+    stopLoop();
+  }
+  initMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  ALOGI("%s: Done in %" PRIu64 "ms", __func__, initMs.load());
+
+  // Calls made meanwhile apply on top of the restored state, in order
+  while (true) {
+    {
+      ScopedLock _(init_lock);
+      if (pendingCalls.empty()) {
+        kInitDone = true;
+        queuedState.reset();
+        break;
+      }
+      calls.swap(pendingCalls);
+    }
+    ALOGD("%s: Replaying %zu call(s)", __func__, calls.size());
+    for (const auto& call : calls)
+      call();
+    calls.clear();
   }
+  // Held back until now, clients registered meanwhile get their first status
+  notifyStatusChanged();
 }
 
-enum ChargeStatus {
-  ON,
-  OFF,
-  NOOP,
-};
+// Same outcome as initialize() has, as the properties have the final say
+// over the saved state. Binder threads call it, so it does not wait for the
+// properties to be created.
+SmartCharge::QueuedState SmartCharge::stateAfterInit(void) {
+  QueuedState s{kInvalidCfg, kInvalidCfg, false, false};
+  ConfigPair<int> limits{};
+  ConfigPair<bool> enabled{};
 
-void SmartCharge::startLoop(bool withrestart) {
-  ChargeStatus tmp;
-  bool initdone = false;
-  status = ChargeStatus::NOOP;
+  if (!getAndParse(kSmartChargeConfigProp, &limits, false) ||
+      !verifyConfig(limits.first, limits.second))
+    return s;
+  s.upper = limits.second;
+  s.lower = limits.first;
+  if (getAndParse(kSmartChargeEnabledProp, &enabled, false) && enabled.first) {
+    s.restart = enabled.second;
+    // Otherwise loadEnabledAndStart() gives up on it
+    s.enabled = !(s.restart && s.lower == kInvalidCfg);
+  }
+  return s;
+}
 
-  ALOGD("%s: ++", __func__);
-  std::unique_lock<std::mutex> lock(kCVLock);
-  while (true) {
-    int per;
+std::optional<SmartCharge::QueuedState> SmartCharge::stateDuringInit(void) {
+  if (kInitDone)
+    return std::nullopt;
+  const auto initial = stateAfterInit();
+  ScopedLock _(init_lock);
+  if (kInitDone)
+    return std::nullopt;
+  return queuedState ? *queuedState : initial;
+}
+
+bool SmartCharge::deferUntilInit(const std::function<binder_exception_t(QueuedState&)>& check,
+                                 std::function<void()> fn, ndk::ScopedAStatus* status) {
+  const auto initPending = [this] {
+    // Replayed calls run on the init thread
+    return !kInitDone && std::this_thread::get_id() != initThreadId;
+  };
+
+  {
+    ScopedLock _(init_lock);
+    if (!initPending())
+      return false;
+  }
+  // Read outside of init_lock, as it holds up initialize() too
+  const auto initial = stateAfterInit();
+  ScopedLock _(init_lock);
+  // Done meanwhile, the call goes through as usual
+  if (!initPending())
+    return false;
+  if (!queuedState)
+    queuedState = initial;
+  // Checked on a copy, a rejected call leaves the queued state alone
+  auto next = *queuedState;
+  const auto ex = check(next);
+  if (ex == EX_NONE) {
+    queuedState = next;
+    pendingCalls.emplace_back(std::move(fn));
+  }
+  *status = ndk::ScopedAStatus::fromExceptionCode(ex);
+  return true;
+}
+
+static uint64_t nowNs(clockid_t clock) {
+  struct timespec ts {};
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
-    switch (healthState) {
-    case USE_HEALTH_AIDL: {
+void SmartCharge::selectCapacitySource(void) {
+  // A configured node wins over the module
+  capacityNode = GetProperty(kSmartChargeCapacityNodeProp, "");
+  if (!capacityNode.empty()) {
+    capacityFd = open(capacityNode.c_str(), O_RDONLY | O_CLOEXEC);
+    if (capacityFd >= 0) {
+      ALOGD("%s: Reading capacity from '%s'", __func__, capacityNode.c_str());
+      directCapacity = DIRECT_SYSFS;
+      return;
+    }
+    ALOGW("%s: Cannot open '%s': %s", __func__, capacityNode.c_str(), strerror(errno));
+  }
+  if (module && (moduleCaps & BATTERY_CAP_CAPACITY) && module->getCapacity) {
+    ALOGD("%s: Reading capacity from module", __func__);
+    directCapacity = DIRECT_MODULE;
+  }
+}
 
-      ScopedLock _(hal_health_lock);
-      auto ret = health_aidl->getCapacity(&per);
-      if (!ret.isOk()) {
-	per = ret.getStatus();
+void SmartCharge::dropDirectCapacity(const char* reason) {
+  ALOGW("%s: Falling back to health HAL: %s", __func__, reason);
+  if (capacityFd >= 0)
+    close(capacityFd);
+  capacityFd = -1;
+  directCapacity = DIRECT_NONE;
+}
+
+int SmartCharge::readModuleCapacity(void) {
+  const uint64_t wall = nowNs(CLOCK_MONOTONIC), cpu = nowNs(CLOCK_THREAD_CPUTIME_ID);
+  int per = -1;
+  const int rc = module->getCapacity(&per);
+
+  if (rc < 0 || per < 0 || per > 100) {
+    errno = rc < 0 ? -rc : EINVAL;
+    return -1;
+  }
+  moduleReadStats.add(nowNs(CLOCK_MONOTONIC) - wall, nowNs(CLOCK_THREAD_CPUTIME_ID) - cpu);
+  return per;
+}
+
+int SmartCharge::readSysfsCapacity(void) {
+  const uint64_t wall = nowNs(CLOCK_MONOTONIC), cpu = nowNs(CLOCK_THREAD_CPUTIME_ID);
+  char buf[8];
+  char* end;
+  long per;
+
+  // Persistent fd, sysfs regenerates the value on each read from offset 0
+  const ssize_t len = pread(capacityFd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0) {
+    if (len == 0)
+      errno = ENODATA;
+    return -1;
+  }
+  buf[len] = '\0';
+  per = strtol(buf, &end, 10);
+  if (end == buf || per < 0 || per > 100) {
+    errno = EINVAL;
+    return -1;
+  }
+  sysfsReadStats.add(nowNs(CLOCK_MONOTONIC) - wall, nowNs(CLOCK_THREAD_CPUTIME_ID) - cpu);
+  return per;
+}
+
+int SmartCharge::readCapacity(void) {
+  if (directCapacity != DIRECT_NONE) {
+    const bool sysfs = directCapacity == DIRECT_SYSFS;
+    const int per = sysfs ? readSysfsCapacity() : readModuleCapacity();
+    if (per < 0) {
+      dropDirectCapacity(strerror(errno));
+    } else if (++directReads % kCrossCheckEvery != 0) {
+      return per;
+    } else {
+      // Make sure the source tracks what the rest of the system sees
+      const int hal = readHalCapacity();
+      if (hal >= 0 && std::abs(hal - per) > kCrossCheckSlack) {
+        ALOGW("%s: '%s' reads %d, health HAL %d", __func__,
+              sysfs ? capacityNode.c_str() : "module", per, hal);
+        if (++directMismatches >= kMaxMismatches)
+          dropDirectCapacity("Too many mismatches");
+        return hal;
       }
-      break;
+      return hal >= 0 ? hal : per;
     }
-    case USE_HEALTH_HIDL: {
-      using ::android::hardware::health::V2_0::Result;
-
-      ScopedLock _(hal_health_lock);
-      Result res = Result::UNKNOWN;
-      health_hidl->getCapacity([&res, &per](Result hal_res, int32_t hal_value) {
-        res = hal_res;
-        per = hal_value;
-      });
-      if (res != Result::SUCCESS)
-        per = -(static_cast<int>(res));
-      break;
+  }
+  const int per = readHalCapacity();
+  if (per == kHalUnavailable) {
+    // Carry on with what was seen last, the HAL may never come back otherwise
+    ++halStalls;
+    if (!kReconnecting)
+      startHealthReconnect();
+    return lastCapacity >= 0 ? lastCapacity.load() : kHalUnavailable;
+  }
+  return per;
+}
+
+int SmartCharge::readHalCapacity(void) {
+  const uint64_t wall = nowNs(CLOCK_MONOTONIC), cpu = nowNs(CLOCK_THREAD_CPUTIME_ID);
+  int per = -1;
+
+  ScopedLock _(hal_health_lock);
+  switch (healthState) {
+  case USE_HEALTH_AIDL: {
+
+    auto ret = health_aidl->getCapacity(&per);
+    if (ret.getExceptionCode() == EX_TRANSACTION_FAILED) {
+      per = kHalUnavailable;
+    } else if (!ret.isOk()) {
+      per = ret.getStatus();
     }
+    break;
+  }
+  case USE_HEALTH_HIDL: {
+    using ::android::hardware::health::V2_0::Result;
+
+    Result res = Result::UNKNOWN;
+    auto ret = health_hidl->getCapacity([&res, &per](Result hal_res, int32_t hal_value) {
+      res = hal_res;
+      per = hal_value;
+    });
+    if (!ret.isOk())
+      per = kHalUnavailable;
+    else if (res != Result::SUCCESS)
+      per = -(static_cast<int>(res));
+    break;
+  }
+  default:
+    // Disconnected, reconnecting
+    per = kHalUnavailable;
+    break;
+  }
+  if (per >= 0) {
+    auto& stats = healthState == USE_HEALTH_AIDL ? aidlReadStats : hidlReadStats;
+    stats.add(nowNs(CLOCK_MONOTONIC) - wall, nowNs(CLOCK_THREAD_CPUTIME_ID) - cpu);
+  }
+  return per;
+}
+
+bool SmartCharge::waitForEvent(std::unique_lock<std::mutex>& lock, bool* fromEvent) {
+  auto pred = [this] { return kStopLoop || kEventPending; };
+
+  if (!healthCallbackRegistered)
+    cv.wait_for(lock, std::chrono::milliseconds(pollDelayMs.load()), pred);
+  else if (!chargerOnline)
+    // Plugging in is an event, sleep until then
+    cv.wait(lock, pred);
+  else
+    cv.wait_for(lock, kFallbackInterval, pred);
+  *fromEvent = kEventPending;
+  kEventPending = false;
+  ++loopWakeups;
+  return !kStopLoop;
+}
+
+void SmartCharge::setChargable(bool enable) {
+  const uint64_t wall = nowNs(CLOCK_MONOTONIC), cpu = nowNs(CLOCK_THREAD_CPUTIME_ID);
+
+  setChargableFunc(enable);
+  switchStats.add(nowNs(CLOCK_MONOTONIC) - wall, nowNs(CLOCK_THREAD_CPUTIME_ID) - cpu);
+}
+
+static const char* const kStatusNames[] = {"ON", "OFF", "NOOP"};
+
+void SmartCharge::recordLoopState(int per, const ChargeConfig& cfg) {
+  const int64_t now = steadyClock.nowMs();
+  const ChargeStatus next = controller.status();
+
+  if (per > cfg.upper) {
+    int max = overshootMax;
+    ++overshootReadings;
+    while (per - cfg.upper > max && !overshootMax.compare_exchange_weak(max, per - cfg.upper))
+      ;
+  }
+  if (next != status) {
+    statusMs[status] += now - statusSinceMs;
+    statusSinceMs = now;
+    status = next;
+    notifyStatusChanged();
+  }
+  lastCapacity = per;
+  if (per != historyCapacity || next != historyStatus) {
+    history.add(now, per, next);
+    historyCapacity = per;
+    historyStatus = next;
+    saveState();
+  }
+  toggles = controller.toggles();
+}
+
+void SmartCharge::startLoop(void) {
+  bool fromEvent = false;
+
+  controller.reset();
+  // Left as the previous instance had it, see restoreState()
+  controller.restore(restoredStatus);
+  status = restoredStatus;
+  restoredStatus = ChargeStatus::NOOP;
+  statusSinceMs = steadyClock.nowMs();
+  historyCapacity = -1;
+  pollDelayMs = kPollPolicy.min.count();
+  ALOGD("%s: ++", __func__);
+  while (true) {
+    const uint64_t wall = nowNs(CLOCK_MONOTONIC), cpu = nowNs(CLOCK_THREAD_CPUTIME_ID);
+    ++loopIterations;
+    // Taken each iteration, a new config applies on the next wakeup
+    const auto cfg = std::atomic_load(&config);
+    // Events carry the capacity already, timeouts ask the HAL
+    const int per = controller.step(*cfg, fromEvent ? lastCapacity.load() : -1);
+
+    if (per == kHalUnavailable) {
+      // Nothing known yet, wait for the health HAL to return
+      std::unique_lock<std::mutex> lock(kCVLock);
+      if (!waitForEvent(lock, &fromEvent))
+        break;
+      continue;
     }
     if (per < 0) {
       kRunning = false;
+      notifyStatusChanged();
       SetProperty(kSmartChargeEnabledProp, kDisabledCfgStr);
       ALOGE("%s: exit loop: retval: %d", __func__, per);
       break;
     }
-    if (per > upper)
-      tmp = ChargeStatus::OFF;
-    else if (withrestart && per < lower)
-      tmp = ChargeStatus::ON;
-    else if (!withrestart && per <= upper - 1)
-      tmp = ChargeStatus::ON;
-    else
-      tmp = ChargeStatus::NOOP;
-    if (tmp != status || !initdone) {
-      switch (tmp) {
-      case ChargeStatus::OFF:
-        setChargableFunc(false);
-        break;
-      case ChargeStatus::ON:
-        setChargableFunc(true);
-        break;
-      default:
-        break;
-      }
-      status = tmp;
-      initdone = true;
-    }
-    if (cv.wait_for(lock, 5s) == std::cv_status::no_timeout) {
-      // cv signaled, exit now
+    recordLoopState(per, *cfg);
+    pollDelayMs = controller.pollDelay().count();
+    loopStats.add(nowNs(CLOCK_MONOTONIC) - wall, nowNs(CLOCK_THREAD_CPUTIME_ID) - cpu);
+    std::unique_lock<std::mutex> lock(kCVLock);
+    if (!waitForEvent(lock, &fromEvent)) {
+      // Asked to stop, exit now
       break;
     }
   }
-  lock.unlock();
+  statusMs[status] += steadyClock.nowMs() - statusSinceMs;
+  statusSinceMs = 0;
   ALOGD("%s: --", __func__);
 }
 
-void SmartCharge::createLoopThread(bool restart) {
-  ScopedLock _(thread_lock);
+// Must hold thread_lock
+bool SmartCharge::createLoopThread(bool restart) {
   ALOGD("%s: create thread", __func__);
-  kLoopThread = std::make_shared<std::thread>(&SmartCharge::startLoop, this, restart);
+  // The loop may have exited on its own
+  if (kLoopThread && kLoopThread->joinable())
+    kLoopThread->join();
+  // Set first, limits changed from here on are checked as for a running loop
   kRunning = true;
+  if (!updateConfig([restart](ChargeConfig& c) { return setRestart(c, restart); })) {
+    kRunning = false;
+    return false;
+  }
+  {
+    ScopedLock _(kCVLock);
+    kStopLoop = false;
+    kEventPending = false;
+  }
+  kLoopThread = std::make_shared<std::thread>(&SmartCharge::startLoop, this);
+  notifyStatusChanged();
+  return true;
+}
+
+// Must hold thread_lock
+void SmartCharge::stopLoop(void) {
+  setChargable(true);
+  restoredStatus = ChargeStatus::NOOP;
+  if (kLoopThread && kLoopThread->joinable()) {
+    {
+      ScopedLock _(kCVLock);
+      kStopLoop = true;
+    }
+    cv.notify_one();
+    kLoopThread->join();
+  }
+  kLoopThread.reset();
+  kRunning = false;
+  notifyStatusChanged();
+}
+
+bool SmartCharge::restoreState(void) {
+  SavedState saved{};
+
+  if (!stateStore.load(&saved) || saved.status < ChargeStatus::ON ||
+      saved.status > ChargeStatus::NOOP) {
+    kStateLoaded = true;
+    return false;
+  }
+  ALOGI("%s: status %d, capacity %d, limits %d/%d, restart %d, running %d, source %d",
+        __func__, saved.status, saved.capacity, saved.upper, saved.lower, saved.restart,
+        saved.running, saved.capacitySource);
+  loadImplLibrary();
+  selectCapacitySource();
+  // A source given up on stays given up on
+  if (saved.capacitySource == DIRECT_NONE && directCapacity != DIRECT_NONE)
+    dropDirectCapacity("Dropped before the restart");
+  updateConfig([&saved](ChargeConfig& c) {
+    c.upper = saved.upper;
+    c.lower = saved.lower;
+    c.restart = saved.restart;
+    return true;
+  });
+  if (saved.capacity >= 0)
+    lastCapacity = saved.capacity;
+  if (!saved.running || !verifyConfig(saved.lower, saved.upper)) {
+    kStateLoaded = true;
+    return true;
+  }
+
+  restoredStatus = static_cast<ChargeStatus>(saved.status);
+  status = restoredStatus;
+  // Make sure the hardware is where the loop will assume it is
+  if (restoredStatus != ChargeStatus::NOOP)
+    setChargable(restoredStatus == ChargeStatus::ON);
+  // Only a direct source can be read before the health HAL is connected,
+  // otherwise the loop starts once it is
+  if (directCapacity != DIRECT_NONE) {
+    ScopedLock _(thread_lock);
+    if (!createLoopThread(saved.restart)) {
+      ALOGW("%s: Saved restart mode without a lower limit, not starting", __func__);
+      stopLoop();
+    }
+  }
+  kStateLoaded = true;
+  return true;
+}
+
+void SmartCharge::saveState(void) {
+  const auto cfg = std::atomic_load(&config);
+  SavedState state{};
+
+  if (!kStateLoaded)
+    return;
+  state.status = status;
+  state.capacity = lastCapacity;
+  state.upper = cfg->upper;
+  state.lower = cfg->lower;
+  state.restart = cfg->restart;
+  state.running = kRunning;
+  state.capacitySource = directCapacity;
+  stateStore.save(state);
 }
 
 ndk::ScopedAStatus SmartCharge::setChargeLimit(int32_t upper_, int32_t lower_) {
-  ALOGD("%s: upper: %d, lower: %d, kRun: %d", __func__, upper_, lower_, kRunning);
+  ALOGD("%s: upper: %d, lower: %d, kRun: %d", __func__, upper_, lower_, kRunning.load());
   if (!verifyConfig(lower_, upper_))
     return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
-  if (kRunning)
-    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
   if (lower_ < 0)
     lower_ = kInvalidCfg;
+  // Not ready yet, checked against what the queued calls leave so that the
+  // replayed call succeeds
+  ndk::ScopedAStatus deferred;
+  if (deferUntilInit(
+          [upper_, lower_](QueuedState& s) {
+            if (lower_ == kInvalidCfg && s.enabled && s.restart)
+              return EX_ILLEGAL_STATE;
+            s.upper = upper_;
+            s.lower = lower_;
+            return EX_NONE;
+          },
+          [this, upper_, lower_] { setChargeLimit(upper_, lower_); }, &deferred))
+    return deferred;
+  // Applies to a running loop right away. Restart mode needs a lower limit,
+  // checked against the config being replaced so a concurrent activate()
+  // cannot slip in between.
+  if (!updateConfig([this, upper_, lower_](ChargeConfig& c) {
+        if (lower_ == kInvalidCfg && kRunning && c.restart)
+          return false;
+        c.upper = upper_;
+        c.lower = lower_;
+        return true;
+      }))
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
   auto pair = ConfigPair<int>{lower_, upper_};
   SetProperty(kSmartChargeConfigProp, pair.toString());
-  {
-    std::unique_lock<std::mutex> _(config_lock);
-    lower = lower_;
-    upper = upper_;
-  }
   ALOGD("%s: Exit", __func__);
   return ndk::ScopedAStatus::ok();
 }
 
 ndk::ScopedAStatus SmartCharge::activate(bool enable, bool restart) {
+  // Not ready yet, checked the same way as below against what the queued
+  // calls leave. The replayed call should not fail then, but is logged if so.
+  ndk::ScopedAStatus deferred;
+  if (deferUntilInit(
+          [enable, restart](QueuedState& s) {
+            if (!verifyConfig(s.lower, s.upper))
+              return EX_ILLEGAL_STATE;
+            if (!enable && !s.enabled)
+              return EX_ILLEGAL_ARGUMENT;
+            if (enable && restart && s.lower == kInvalidCfg)
+              return EX_ILLEGAL_ARGUMENT;
+            s.enabled = enable;
+            if (enable)
+              s.restart = restart;
+            return EX_NONE;
+          },
+          [this, enable, restart] {
+            auto ret = activate(enable, restart);
+            if (!ret.isOk())
+              ALOGW("Queued activate(%d, %d) failed: %s", enable, restart,
+                    ret.getDescription().c_str());
+          },
+          &deferred))
+    return deferred;
+
   auto pair = ConfigPair<bool>{enable, restart};
-  {
-    std::unique_lock<std::mutex> _(config_lock);
-    ALOGD("%s: upper: %d, lower: %d, enable: %d, restart: %d, kRun: %d",
-          __func__, upper, lower, enable, restart, kRunning);
-    if (!verifyConfig(lower, upper))
-      return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
-    if (lower == kInvalidCfg && restart)
-      return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+  const auto cfg = std::atomic_load(&config);
+
+  ALOGD("%s: upper: %d, lower: %d, enable: %d, restart: %d, kRun: %d",
+        __func__, cfg->upper, cfg->lower, enable, restart, kRunning.load());
+  if (!verifyConfig(cfg->lower, cfg->upper))
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_STATE);
+
+  ScopedLock _(thread_lock);
+  if (enable && kRunning) {
+    // Only switches the restart mode of the running loop
+    if (cfg->restart != restart) {
+      if (!updateConfig([restart](ChargeConfig& c) { return setRestart(c, restart); }))
+        return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+      SetProperty(kSmartChargeEnabledProp, pair.toString());
+    }
+    return ndk::ScopedAStatus::ok();
   }
-  if (kRunning == enable)
+  if (!enable && !kRunning)
     return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
-  SetProperty(kSmartChargeEnabledProp, pair.toString());
   if (enable) {
-    if (kRunning) {
-      ALOGW("Thread is running?");
-    } else {
-      createLoopThread(restart);
-    }
+    if (!createLoopThread(restart))
+      return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
   } else {
-    setChargableFunc(true);
-    if (kRunning) {
-      ScopedLock _(thread_lock);
-      if (kLoopThread->joinable()) {
-        cv.notify_one();
-        kLoopThread->join();
-      }
-      kLoopThread.reset();
-      kRunning = false;
-    } else {
-      ALOGW("No threads to stop?");
-    }
+    stopLoop();
   }
+  SetProperty(kSmartChargeEnabledProp, pair.toString());
   ALOGD("%s: Exit", __func__);
   return ndk::ScopedAStatus::ok();
 }
 
+uint64_t SmartCharge::timeInStatusMs(ChargeStatus which) {
+  const int64_t since = statusSinceMs;
+  uint64_t ms = statusMs[which];
+
+  // Plus the time since the last change, if still there
+  if (kRunning && since > 0 && status == which)
+    ms += steadyClock.nowMs() - since;
+  return ms;
+}
+
+SmartChargeStatus SmartCharge::buildStatus(void) {
+  const auto cfg = std::atomic_load(&config);
+  SmartChargeStatus ret;
+
+  ret.running = kRunning;
+  ret.restart = cfg->restart;
+  ret.upper = cfg->upper;
+  ret.lower = cfg->lower;
+  // Still the defaults during init, answer with what it is going to be
+  if (const auto s = stateDuringInit()) {
+    ret.running = s->enabled;
+    ret.restart = s->restart;
+    ret.upper = s->upper;
+    ret.lower = s->lower;
+  }
+  // ChargeStatus shares the values of SmartChargeStatus::STATE_*
+  ret.state = status.load();
+  ret.capacity = lastCapacity;
+  ret.chargerOnline = chargerOnline;
+  ret.loopIterations = loopIterations;
+  ret.toggles = toggles;
+  ret.overshootMax = overshootMax;
+  ret.timeOnMs = timeInStatusMs(ChargeStatus::ON);
+  ret.timeOffMs = timeInStatusMs(ChargeStatus::OFF);
+  return ret;
+}
+
+void SmartCharge::notifyStatusChanged(void) {
+  saveState();
+  // Sent once initialize() is done, not the state in between
+  if (!kInitDone)
+    return;
+  {
+    ScopedLock _(callback_lock);
+    if (callbacks.empty() || kCallbackPending)
+      return;
+    kCallbackPending = true;
+  }
+  ++statusNotifies;
+  callbackCv.notify_one();
+}
+
+void SmartCharge::callbackLoop(void) {
+  std::unique_lock<std::mutex> lock(callback_lock);
+
+  while (true) {
+    callbackCv.wait(lock, [this] { return kStopCallbacks || kCallbackPending; });
+    if (kStopCallbacks)
+      break;
+    kCallbackPending = false;
+    auto targets = callbacks;
+    lock.unlock();
+
+    // Built after clearing the flag, so a transition from now on is sent again
+    const SmartChargeStatus current = buildStatus();
+    std::vector<std::shared_ptr<ISmartChargeCallback>> dead;
+    for (const auto& cb : targets) {
+      auto ret = cb->onStatusChanged(current);
+      ++callbacksSent;
+      if (ret.getStatus() == STATUS_DEAD_OBJECT)
+        dead.emplace_back(cb);
+    }
+
+    lock.lock();
+    for (const auto& cb : dead) {
+      ALOGD("%s: Dropping callback of a dead client", __func__);
+      callbacks.erase(std::remove(callbacks.begin(), callbacks.end(), cb), callbacks.end());
+    }
+  }
+}
+
+ndk::ScopedAStatus SmartCharge::getStatus(SmartChargeStatus* _aidl_return) {
+  ++statusQueries;
+  *_aidl_return = buildStatus();
+  return ndk::ScopedAStatus::ok();
+}
+
+ndk::ScopedAStatus SmartCharge::registerCallback(
+    const std::shared_ptr<ISmartChargeCallback>& callback) {
+  if (!callback)
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+  {
+    ScopedLock _(callback_lock);
+    for (const auto& cb : callbacks) {
+      if (cb->asBinder() == callback->asBinder())
+        return ndk::ScopedAStatus::ok();
+    }
+    callbacks.emplace_back(callback);
+    if (!kCallbackThread.joinable())
+      kCallbackThread = std::thread(&SmartCharge::callbackLoop, this);
+  }
+  // Let the client know where things are right away
+  notifyStatusChanged();
+  return ndk::ScopedAStatus::ok();
+}
+
+ndk::ScopedAStatus SmartCharge::unregisterCallback(
+    const std::shared_ptr<ISmartChargeCallback>& callback) {
+  if (!callback)
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+
+  ScopedLock _(callback_lock);
+  auto it = std::find_if(callbacks.begin(), callbacks.end(), [&callback](const auto& cb) {
+    return cb->asBinder() == callback->asBinder();
+  });
+  if (it == callbacks.end())
+    return ndk::ScopedAStatus::fromExceptionCode(EX_ILLEGAL_ARGUMENT);
+  callbacks.erase(it);
+  return ndk::ScopedAStatus::ok();
+}
+
 binder_status_t SmartCharge::dump(int fd, const char** /* args */, uint32_t /* numArgs */) {
-  auto tryLockFn = [](const std::mutex& m) {
+  auto tryLockFn = [](std::mutex& m) {
      const std::unique_lock<std::mutex> lk{m, std::try_to_lock};
      return lk.owns_lock();
-  }
+  };
 
-  dprintf(fd, "Loop thread running: %d\n", kRunning);
+  {
+    ScopedLock _(init_lock);
+    if (!kInitDone) {
+      dprintf(fd, "Initializing, %zu call(s) queued\n", pendingCalls.size());
+      return STATUS_OK;
+    }
+  }
+  dprintf(fd, "Initialized in %" PRIu64 "ms, from saved state: %d, state saves: %" PRIu64 "\n",
+          initMs.load(), kRestored.load(), stateStore.saveCount());
+  dprintf(fd, "Loop thread running: %d\n", kRunning.load());
   if (kRunning) {
      dprintf(fd, "Loop thread charge control state\n");
      switch (status) {
@@ -376,9 +1159,11 @@ binder_status_t SmartCharge::dump(int fd, const char** /* args */, uint32_t /* n
      }
      dprintf(fd, "\n");
   }
-  dprintf(fd, "Configuration (upper/lower): %d %d\n", upper, lower);
-  dprintf(fd, "Mutex locked (config/thread/cv) %d %d %d\n", tryLockFn(config_lock),
-     tryLockFn(thread_lock), tryLockFn(kCVLock));
+  const auto cfg = std::atomic_load(&config);
+  dprintf(fd, "Configuration (upper/lower/restart): %d %d %d\n", cfg->upper, cfg->lower,
+          cfg->restart);
+  dprintf(fd, "Configuration updates: %" PRIu64 "\n", configUpdates.load());
+  dprintf(fd, "Mutex locked (thread/cv) %d %d\n", tryLockFn(thread_lock), tryLockFn(kCVLock));
   dprintf(fd, "Connected Health HAL: ");
   switch (healthState) {
      case USE_HEALTH_AIDL:
@@ -388,14 +1173,92 @@ binder_status_t SmartCharge::dump(int fd, const char** /* args */, uint32_t /* n
          dprintf(fd, "HIDL Health HAL V2.0");
 	 break;
      default:
+         dprintf(fd, "none");
          break;
   };
   dprintf(fd, "\n");
+  dprintf(fd, "Health HAL reconnecting: %d, reconnects: %" PRIu64 ", last took %" PRIu64
+          "ms, total %" PRIu64 "ms\n", kReconnecting.load(), halReconnects.load(),
+          lastReconnectMs.load(), totalReconnectMs.load());
+  dprintf(fd, "Loop stalls on health HAL: %" PRIu64 "\n", halStalls.load());
+  dprintf(fd, "Health info callback: %s\n",
+          healthCallbackRegistered ? "registered" : "not registered, polling");
+  dprintf(fd, "Last capacity: %d, charger online: %d\n", lastCapacity.load(),
+          chargerOnline.load());
+  dprintf(fd, "Health events: %" PRIu64 ", loop wakeups: %" PRIu64 "\n",
+          healthEvents.load(), loopWakeups.load());
+  if (!healthCallbackRegistered)
+    dprintf(fd, "Next poll in: %" PRId64 "ms\n", pollDelayMs.load());
+  dprintf(fd, "Capacity source: ");
+  switch (directCapacity) {
+     case DIRECT_SYSFS:
+         dprintf(fd, "%s", capacityNode.c_str());
+         break;
+     case DIRECT_MODULE:
+         dprintf(fd, "module");
+         break;
+     default:
+         dprintf(fd, "health HAL");
+         break;
+  }
+  dprintf(fd, ", mismatches: %" PRIu64 "\n", directMismatches.load());
+  aidlReadStats.dump(fd, "Capacity reads (AIDL health HAL)");
+  hidlReadStats.dump(fd, "Capacity reads (HIDL health HAL)");
+  sysfsReadStats.dump(fd, "Capacity reads (sysfs)");
+  moduleReadStats.dump(fd, "Capacity reads (module)");
+  switchStats.dump(fd, "Charge switches");
+  loopStats.dump(fd, "Loop iteration cost");
+  dprintf(fd, "Loop iterations: %" PRIu64 ", toggles: %" PRIu64 "\n", loopIterations.load(),
+          toggles.load());
+  dprintf(fd, "Capacity above upper: %" PRIu64 " readings, max +%d\n",
+          overshootReadings.load(), overshootMax.load());
+  dprintf(fd, "Time in status:");
+  for (size_t i = 0; i < statusMs.size(); ++i)
+    dprintf(fd, " %s %" PRIu64 "s", kStatusNames[i],
+            timeInStatusMs(static_cast<ChargeStatus>(i)) / 1000);
+  dprintf(fd, "\n");
+  dprintf(fd, "Capacity history:\n");
+  history.dump(fd, steadyClock.nowMs(), kStatusNames);
+  {
+    ScopedLock _(callback_lock);
+    dprintf(fd, "Status callbacks: %zu, ", callbacks.size());
+  }
+  dprintf(fd, "notifications: %" PRIu64 ", calls: %" PRIu64 ", status queries: %" PRIu64 "\n",
+          statusNotifies.load(), callbacksSent.load(), statusQueries.load());
   dprintf(fd, "Impl library handle: %p\n", handle);
+  if (module) {
+    int value;
+    dprintf(fd, "Impl module: v%u, caps 0x%x of 0x%x\n", module->version, moduleCaps,
+            module->caps);
+    if ((moduleCaps & BATTERY_CAP_STATUS) && module->getStatus && module->getStatus(&value) == 0)
+      dprintf(fd, "Module battery status: %d\n", value);
+    if ((moduleCaps & BATTERY_CAP_INPUT_CURRENT) && module->getInputCurrent &&
+        module->getInputCurrent(&value) == 0)
+      dprintf(fd, "Module input current: %d uA\n", value);
+  } else if (handle) {
+    dprintf(fd, "Impl module: v1\n");
+  }
 
   return STATUS_OK;
 }
 
+ndk::ScopedAStatus aidl_health_info_callback::healthInfoChanged(
+    const aidl::android::hardware::health::HealthInfo& info) {
+  mService->onHealthInfoChanged(info.batteryLevel,
+                                info.chargerAcOnline || info.chargerUsbOnline ||
+                                    info.chargerWirelessOnline || info.chargerDockOnline);
+  return ndk::ScopedAStatus::ok();
+}
+
+android::hardware::Return<void> hidl_health_info_callback::healthInfoChanged(
+    const android::hardware::health::V2_0::HealthInfo& info) {
+  const auto& legacy = info.legacy;
+  mService->onHealthInfoChanged(legacy.batteryLevel, legacy.chargerAcOnline ||
+                                                         legacy.chargerUsbOnline ||
+                                                         legacy.chargerWirelessOnline);
+  return android::hardware::Void();
+}
+
 using ::android::hardware::interfacesEqual;
 
 void hidl_health_death_recipient::serviceDied(uint64_t cookie,
@@ -8,22 +8,34 @@
 
 #include <aidl/vendor/samsung_ext/framework/battery/BnSmartCharge.h>
 #include <aidl/android/hardware/health/BnHealth.h>
+#include <aidl/android/hardware/health/BnHealthInfoCallback.h>
+#include <android/hardware/health/2.0/IHealthInfoCallback.h>
 #include <healthhalutils/HealthHalUtils.h>
 
+#include <battery.h>
+
+#include "ChargeController.h"
+#include "LoopStats.h"
+#include "StateStore.h"
+
 #include <dlfcn.h>
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
+#include <vector>
 
 using android::hardware::health::V2_0::IHealth;
 using android::hardware::hidl_death_recipient;
 using android::sp;
 using android::wp;
 using IHealthAIDL = aidl::android::hardware::health::IHealth;
+using IHealthInfoCallbackHIDL = android::hardware::health::V2_0::IHealthInfoCallback;
 
 namespace aidl {
 namespace vendor {
@@ -41,19 +53,50 @@ class hidl_health_death_recipient : public hidl_death_recipient {
     sp<IHealth> mHealth;
 };
 
-class SmartCharge : public BnSmartCharge {
+class SmartCharge;
+
+// Forwards health HAL battery updates to SmartCharge, one for each HAL flavor
+class aidl_health_info_callback : public aidl::android::hardware::health::BnHealthInfoCallback {
+  public:
+    aidl_health_info_callback(SmartCharge* service) : mService(service) {}
+    ndk::ScopedAStatus healthInfoChanged(
+        const aidl::android::hardware::health::HealthInfo& info) override;
+
+  private:
+    SmartCharge* mService;
+};
+
+class hidl_health_info_callback : public IHealthInfoCallbackHIDL {
+  public:
+    hidl_health_info_callback(SmartCharge* service) : mService(service) {}
+    android::hardware::Return<void> healthInfoChanged(
+        const android::hardware::health::V2_0::HealthInfo& info) override;
+
+  private:
+    SmartCharge* mService;
+};
+
+class SmartCharge : public BnSmartCharge, public CapacitySource, public ChargeSwitch {
   std::shared_ptr<std::thread> kLoopThread;
-  // Protect above thread pointer
+  // Serializes starting and stopping the above thread, nothing else
   std::mutex thread_lock;
 
-  int upper, lower;
-  // Protect above variables
-  std::mutex config_lock;
+  // Replaced as a whole so the loop picks up changes at once.
+  // Accessed with std::atomic_load/std::atomic_compare_exchange_weak only
+  std::shared_ptr<const ChargeConfig> config = std::make_shared<const ChargeConfig>();
+  std::atomic_uint64_t configUpdates = 0;
+  // Publish a copy of the config modified by [fn], and wake the loop. [fn]
+  // may run more than once, and returns false to reject the change.
+  bool updateConfig(const std::function<bool(ChargeConfig&)>& fn);
+  void notifyLoop();
 
   // Worker function
-  void startLoop(bool withrestart);
-  // Starter function
-  void createLoopThread(bool restart);
+  void startLoop();
+  // Starter function, fails if [restart] is set without a lower limit
+  bool createLoopThread(bool restart);
+  // Must hold thread_lock, charging is left enabled. Also undoes a restored
+  // state whose loop never started.
+  void stopLoop();
 
   // Thread status indicator
   std::atomic_bool kRunning;
@@ -61,38 +104,177 @@ class SmartCharge : public BnSmartCharge {
   std::condition_variable cv;
   // Used by above condition_variable
   std::mutex kCVLock;
+  // Protected by kCVLock, wake reasons of the loop
+  bool kStopLoop = false;
+  bool kEventPending = false;
+
+  // Latest battery state, pushed by the health HAL or read by the loop
+  std::atomic_int lastCapacity = -1;
+  // Assume a charger until told otherwise
+  std::atomic_bool chargerOnline = true;
+  std::atomic_bool healthCallbackRegistered = false;
+  std::atomic_uint64_t healthEvents = 0, loopWakeups = 0;
+
+  // Cost of reading the capacity, per source
+  LatencyStats aidlReadStats, hidlReadStats, sysfsReadStats, moduleReadStats;
+  // Cost of switching charging, and of a loop iteration from wakeup to sleep
+  LatencyStats switchStats, loopStats;
+  std::atomic_uint64_t loopIterations = 0, toggles = 0;
+  // Capacity seen above the upper limit: highest amount, number of readings
+  std::atomic_int overshootMax = 0;
+  std::atomic_uint64_t overshootReadings = 0;
+  // Time spent in each ChargeStatus while the loop ran, plus since the last change
+  std::array<std::atomic_uint64_t, ChargeStatus::NOOP + 1> statusMs{};
+  std::atomic_int64_t statusSinceMs = 0;
+  CapacityHistory history;
+  // Last entry added to the above, loop thread only
+  int historyCapacity = -1;
+  ChargeStatus historyStatus = ChargeStatus::NOOP;
+  // Updates the above from the controller after a step
+  void recordLoopState(int per, const ChargeConfig& cfg);
+  uint64_t timeInStatusMs(ChargeStatus which);
+
+  // Status callbacks, called from their own thread so the loop and binder
+  // calls never wait on clients. Protected by callback_lock.
+  std::vector<std::shared_ptr<ISmartChargeCallback>> callbacks;
+  std::mutex callback_lock;
+  std::condition_variable callbackCv;
+  bool kCallbackPending = false, kStopCallbacks = false;
+  std::thread kCallbackThread;
+  std::atomic_uint64_t statusQueries = 0, statusNotifies = 0, callbacksSent = 0;
+  // Queue a status notification. Any number of them before the callback
+  // thread gets to run result in one call per client, with the latest status.
+  void notifyStatusChanged();
+  void callbackLoop();
+  SmartChargeStatus buildStatus();
+
+  // Capacity read directly instead of asking the health HAL, from a sysfs
+  // node or the module. Changed by the loop thread, or before it starts.
+  enum {
+      DIRECT_NONE,
+      DIRECT_SYSFS,
+      DIRECT_MODULE,
+  };
+  std::atomic_int directCapacity = DIRECT_NONE;
+  std::string capacityNode;
+  int capacityFd = -1;
+  uint64_t directReads = 0;
+  std::atomic_uint64_t directMismatches = 0;
+
+  // Charge control decisions, only used by the loop thread
+  SteadyClock steadyClock;
+  ChargeController controller;
+  std::atomic_int64_t pollDelayMs = 0;
+  std::atomic<ChargeStatus> status = ChargeStatus::NOOP;
 
   void* handle;
   std::function<void(const bool)> setChargableFunc;
+  // Set if the library is a v2 module
+  const battery_module* module = nullptr;
+  // Of the above, what works on this device
+  uint32_t moduleCaps = 0;
 
   sp<IHealth> health_hidl;
   sp<hidl_death_recipient> hidl_death_recp;
+  sp<IHealthInfoCallbackHIDL> hidl_info_callback;
   std::shared_ptr<IHealthAIDL> health_aidl;
   ndk::ScopedAIBinder_DeathRecipient aidl_death_recp;
+  std::shared_ptr<aidl_health_info_callback> aidl_info_callback;
   // Protect health_hal pointers
   std::mutex hal_health_lock;
 
   enum {
-      UNKNOWN
+      UNKNOWN,
       USE_HEALTH_AIDL,
       USE_HEALTH_HIDL,
   } healthState = UNKNOWN;
 
-  enum ChargeStatus {
-      ON,
-      OFF,
-      NOOP,
-  } status;
+  // Health HAL, module and config are loaded here, off the registration path
+  std::thread kInitThread;
+  void initialize();
+  // Binder calls arriving before initialize() is done, replayed in order
+  std::mutex init_lock;
+  // Written under init_lock, read without it by status updates
+  std::atomic_bool kInitDone = false;
+  std::thread::id initThreadId;
+  std::vector<std::function<void()>> pendingCalls;
+  std::atomic_uint64_t initMs = 0;
+  // Config and loop state once initialize() and the queued calls are done
+  struct QueuedState {
+    int upper;
+    int lower;
+    bool enabled;
+    bool restart;
+  };
+  // Taken from the properties on the first queued call
+  std::optional<QueuedState> queuedState;
+  QueuedState stateAfterInit();
+  // The queued state until initialize() is done, nothing after
+  std::optional<QueuedState> stateDuringInit();
+  // Returns true if the call was handled here, with its result in [*status].
+  // [check] is run against the queued state, and either updates it so that
+  // [fn] is queued, or returns the exception the call fails with right away.
+  bool deferUntilInit(const std::function<binder_exception_t(QueuedState&)>& check,
+                      std::function<void()> fn, ndk::ScopedAStatus* status);
 
   bool loadAndParseConfigProp();
   void loadImplLibrary();
   void loadEnabledAndStart();
+  void registerHealthCallback();
+  // CapacitySource
+  int readCapacity() override;
+  // ChargeSwitch
+  void setChargable(bool enable) override;
+  int readHalCapacity();
+  int readSysfsCapacity();
+  int readModuleCapacity();
+  void selectCapacitySource();
+  void dropDirectCapacity(const char* reason);
+  // Sleeps until there is something to do, returns false when asked to stop
+  bool waitForEvent(std::unique_lock<std::mutex>& lock, bool* fromEvent);
+
+  // State handed over to the next instance of the service, so a restart
+  // carries on with the same decision instead of starting from NOOP
+  StateStore stateStore;
+  // Decision of the previous instance, taken over by the next loop start
+  ChargeStatus restoredStatus = ChargeStatus::NOOP;
+  std::atomic_bool kRestored = false;
+  // Set once restoreState() is done, with or without a saved state. Saving is
+  // held off until then, not to overwrite what is yet to be restored.
+  std::atomic_bool kStateLoaded = false;
+  // Returns true if there was a saved state, the loop may be running after
+  bool restoreState();
+  void saveState();
+
+  // Single attempt, returns false if no health HAL is available
+  bool connectHealth();
+  void reconnectHealth();
+  std::thread kReconnectThread;
+  // Protect above thread and kStopReconnect
+  std::mutex reconnect_lock;
+  // Wakes up the retry wait, to stop it on destruction
+  std::condition_variable reconnectCv;
+  bool kStopReconnect = false;
+  std::atomic_bool kReconnecting = false;
+  std::atomic_uint64_t halReconnects = 0, halStalls = 0;
+  std::atomic_uint64_t lastReconnectMs = 0, totalReconnectMs = 0;
 
 public:
-  void loadHealthImpl();
+  // Reconnect in the background with backoff, called on health HAL death
+  void startHealthReconnect();
+  // Called by the health HAL on battery changes, from a binder thread
+  void onHealthInfoChanged(int capacity, bool online);
   SmartCharge();
+  ~SmartCharge();
+  // Start initializing in the background, call once the service is registered
+  void initAsync();
   ndk::ScopedAStatus setChargeLimit(int32_t upper, int32_t lower) override;
   ndk::ScopedAStatus activate(bool enable, bool restart) override;
+  ndk::ScopedAStatus getStatus(SmartChargeStatus* _aidl_return) override;
+  ndk::ScopedAStatus registerCallback(
+      const std::shared_ptr<ISmartChargeCallback>& callback) override;
+  ndk::ScopedAStatus unregisterCallback(
+      const std::shared_ptr<ISmartChargeCallback>& callback) override;
 
   binder_status_t dump(int fd, const char** args, uint32_t numArgs) override;
 };
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "StateStore.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+static constexpr uint32_t kStateMagic = 0x54534353; // "SCST"
+// Bump on any change to SavedState
+static constexpr uint16_t kStateVersion = 1;
+
+namespace {
+struct Record {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  SavedState state;
+  uint32_t checksum;
+};
+} // namespace
+
+// FNV-1a, enough to catch a torn or foreign record
+static uint32_t checksum(const Record& r) {
+  const auto* p = reinterpret_cast<const uint8_t*>(&r);
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < offsetof(Record, checksum); ++i)
+    hash = (hash ^ p[i]) * 16777619u;
+  return hash;
+}
+
+StateStore::~StateStore() {
+  if (fd >= 0)
+    close(fd);
+}
+
+bool StateStore::load(SavedState* out) {
+  std::lock_guard<std::mutex> _(lock);
+  Record r{};
+
+  if (fd < 0)
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0 || pread(fd, &r, sizeof(r), 0) != sizeof(r))
+    return false;
+  if (r.magic != kStateMagic || r.version != kStateVersion || r.size != sizeof(r) ||
+      r.checksum != checksum(r))
+    return false;
+  *out = r.state;
+  last = r.state;
+  haveLast = true;
+  return true;
+}
+
+void StateStore::save(const SavedState& state) {
+  std::lock_guard<std::mutex> _(lock);
+  Record r{};
+
+  if (haveLast && memcmp(&last, &state, sizeof(state)) == 0)
+    return;
+  if (fd < 0)
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    return;
+  r.magic = kStateMagic;
+  r.version = kStateVersion;
+  r.size = sizeof(r);
+  r.state = state;
+  r.checksum = checksum(r);
+  if (pwrite(fd, &r, sizeof(r), 0) == sizeof(r)) {
+    last = state;
+    haveLast = true;
+    ++saves;
+  }
+}
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
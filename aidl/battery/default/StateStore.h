@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace aidl {
+namespace vendor {
+namespace samsung_ext {
+namespace framework {
+namespace battery {
+
+// What a restarted service needs to carry on controlling right away
+struct SavedState {
+  int32_t status;
+  int32_t capacity;
+  int32_t upper, lower;
+  uint8_t restart, running;
+  // Where the capacity is read from, SmartCharge::DIRECT_*
+  uint8_t capacitySource;
+  uint8_t reserved;
+};
+
+/**
+ * Keeps the last SavedState in a small file, meant to live on tmpfs so it
+ * survives the service restarting but not a reboot. The record is versioned
+ * and checksummed, anything else found there is ignored.
+ */
+class StateStore {
+ public:
+  explicit StateStore(const char* path) : path(path) {}
+  ~StateStore();
+
+  // Returns false if there is nothing usable
+  bool load(SavedState* out);
+  // Writes [state] unless it is what was written last
+  void save(const SavedState& state);
+  uint64_t saveCount() const { return saves; }
+
+ private:
+  const char* path;
+  std::mutex lock;
+  // Protected by above lock, except saves
+  int fd = -1;
+  bool haveLast = false;
+  SavedState last{};
+  std::atomic_uint64_t saves = 0;
+};
+
+} // namespace battery
+} // namespace framework
+} // namespace samsung_ext
+} // namespace vendor
+} // namespace aidl
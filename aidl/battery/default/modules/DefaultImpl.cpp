@@ -1,11 +1,40 @@
 #include <battery.h>
-#include <fstream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 static const char kChargeCtlSysfs[] =
     "/sys/class/power_supply/battery/batt_slate_mode";
 
-extern "C" void setChargable(bool enable) {
-  std::ofstream p(kChargeCtlSysfs);
-  if (p)
-    p << !enable;
+// Opened once in init, instead of on every toggle
+static int chargeCtlFd = -1;
+
+static int init(void) {
+  chargeCtlFd = open(kChargeCtlSysfs, O_WRONLY | O_CLOEXEC);
+  return chargeCtlFd < 0 ? -errno : 0;
+}
+
+static void deinit(void) {
+  if (chargeCtlFd >= 0)
+    close(chargeCtlFd);
+  chargeCtlFd = -1;
 }
+
+static int setChargableV2(bool enable) {
+  // Slate mode is the inverse of chargable
+  const char value = enable ? '0' : '1';
+  return pwrite(chargeCtlFd, &value, 1, 0) == 1 ? 0 : -errno;
+}
+
+extern "C" const struct battery_module BATTERY_MODULE = {
+    .version = BATTERY_MODULE_API_VERSION_2,
+    .caps = BATTERY_CAP_CHARGE_CONTROL,
+    .init = init,
+    .deinit = deinit,
+    .setChargable = setChargableV2,
+    .getCapacity = nullptr,
+    .getStatus = nullptr,
+    .getInputCurrent = nullptr,
+    .getCaps = nullptr,
+};
@@ -1,6 +1,126 @@
 #include <battery.h>
 
-extern "C"
-void setChargable(bool enable) {
-  (void) enable;
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char kChargeCtlSysfs[] =
+    "/sys/class/power_supply/battery/batt_slate_mode";
+static const char kCapacitySysfs[] =
+    "/sys/class/power_supply/battery/capacity";
+static const char kStatusSysfs[] =
+    "/sys/class/power_supply/battery/status";
+static const char kInputCurrentSysfs[] =
+    "/sys/class/power_supply/battery/input_current_now";
+
+// Opened once in init, sysfs nodes are re-read from offset 0
+static int chargeCtlFd = -1, capacityFd = -1, statusFd = -1, inputCurrentFd = -1;
+
+static int readNode(int fd, char *buf, size_t size) {
+  if (fd < 0)
+    return -ENODEV;
+  ssize_t len = pread(fd, buf, size - 1, 0);
+  if (len < 0)
+    return -errno;
+  buf[len] = '\0';
+  return 0;
+}
+
+static int readIntNode(int fd, int *out) {
+  char buf[16];
+  char *end;
+  int rc = readNode(fd, buf, sizeof(buf));
+
+  if (rc < 0)
+    return rc;
+  *out = strtol(buf, &end, 10);
+  return end == buf ? -EINVAL : 0;
+}
+
+static int init(void) {
+  chargeCtlFd = open(kChargeCtlSysfs, O_WRONLY | O_CLOEXEC);
+  // Only charge control is mandatory
+  if (chargeCtlFd < 0)
+    return -errno;
+  capacityFd = open(kCapacitySysfs, O_RDONLY | O_CLOEXEC);
+  statusFd = open(kStatusSysfs, O_RDONLY | O_CLOEXEC);
+  inputCurrentFd = open(kInputCurrentSysfs, O_RDONLY | O_CLOEXEC);
+  return 0;
+}
+
+// The optional nodes that could be opened in init, SmartCharge logs the rest
+static uint32_t getCaps(void) {
+  uint32_t caps = BATTERY_CAP_CHARGE_CONTROL;
+  if (capacityFd >= 0)
+    caps |= BATTERY_CAP_CAPACITY;
+  if (statusFd >= 0)
+    caps |= BATTERY_CAP_STATUS;
+  if (inputCurrentFd >= 0)
+    caps |= BATTERY_CAP_INPUT_CURRENT;
+  return caps;
+}
+
+static void closeNode(int *fd) {
+  if (*fd >= 0)
+    close(*fd);
+  *fd = -1;
 }
+
+static void deinit(void) {
+  closeNode(&chargeCtlFd);
+  closeNode(&capacityFd);
+  closeNode(&statusFd);
+  closeNode(&inputCurrentFd);
+}
+
+static int setChargableV2(bool enable) {
+  // Slate mode is the inverse of chargable
+  const char value = enable ? '0' : '1';
+  return pwrite(chargeCtlFd, &value, 1, 0) == 1 ? 0 : -errno;
+}
+
+static int getCapacity(int *percent) {
+  return readIntNode(capacityFd, percent);
+}
+
+static int getStatus(int *status) {
+  static const struct {
+    const char *name;
+    int status;
+  } kStatus[] = {
+      {"Charging", BATTERY_STATUS_CHARGING},
+      {"Discharging", BATTERY_STATUS_DISCHARGING},
+      {"Not charging", BATTERY_STATUS_NOT_CHARGING},
+      {"Full", BATTERY_STATUS_FULL},
+  };
+  char buf[32];
+  int rc = readNode(statusFd, buf, sizeof(buf));
+
+  if (rc < 0)
+    return rc;
+  *status = BATTERY_STATUS_UNKNOWN;
+  for (const auto &s : kStatus) {
+    if (strncmp(buf, s.name, strlen(s.name)) == 0)
+      *status = s.status;
+  }
+  return 0;
+}
+
+static int getInputCurrent(int *microamps) {
+  return readIntNode(inputCurrentFd, microamps);
+}
+
+extern "C" const struct battery_module BATTERY_MODULE = {
+    .version = BATTERY_MODULE_API_VERSION_2,
+    .caps = BATTERY_CAP_CHARGE_CONTROL | BATTERY_CAP_CAPACITY | BATTERY_CAP_STATUS |
+            BATTERY_CAP_INPUT_CURRENT,
+    .init = init,
+    .deinit = deinit,
+    .setChargable = setChargableV2,
+    .getCapacity = getCapacity,
+    .getStatus = getStatus,
+    .getInputCurrent = getInputCurrent,
+    .getCaps = getCaps,
+};
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/cdefs.h>
 
 __BEGIN_DECLS
 
 /**
+ * Module API v1
+ *
  * setChargable - Target specific method of enabling charge.
  *
  * @param enable Enable charging or not
@@ -13,4 +16,59 @@ __BEGIN_DECLS
  */
 extern void setChargable(const bool enable);
 
+/**
+ * Module API v2
+ *
+ * A v2 module exports a struct battery_module named BATTERY_MODULE instead of
+ * the v1 symbol. init() runs once after loading, so nodes can be opened there
+ * and kept open, and deinit() before unloading. Entry points not covered by
+ * caps may be NULL. All of them but getCaps() return 0 or a negative errno.
+ *
+ * caps lists what the module can do at most. If getCaps() is set, it is
+ * called after init() and returns what works on this device, like the
+ * nodes that could be opened.
+ */
+#define BATTERY_MODULE_API_VERSION_2 2
+#define BATTERY_MODULE_SYM "BATTERY_MODULE"
+
+enum battery_module_caps {
+  // setChargable() is implemented
+  BATTERY_CAP_CHARGE_CONTROL = 1 << 0,
+  // getCapacity() is implemented, and cheaper than asking the health HAL
+  BATTERY_CAP_CAPACITY = 1 << 1,
+  // getStatus() is implemented
+  BATTERY_CAP_STATUS = 1 << 2,
+  // getInputCurrent() is implemented
+  BATTERY_CAP_INPUT_CURRENT = 1 << 3,
+};
+
+// Same as power_supply's status attribute
+enum battery_status {
+  BATTERY_STATUS_UNKNOWN,
+  BATTERY_STATUS_CHARGING,
+  BATTERY_STATUS_DISCHARGING,
+  BATTERY_STATUS_NOT_CHARGING,
+  BATTERY_STATUS_FULL,
+};
+
+struct battery_module {
+  // BATTERY_MODULE_API_VERSION_2
+  uint32_t version;
+  // Bitmask of enum battery_module_caps
+  uint32_t caps;
+  int (*init)(void);
+  void (*deinit)(void);
+  int (*setChargable)(bool enable);
+  // Battery level in percent
+  int (*getCapacity)(int *percent);
+  // One of enum battery_status
+  int (*getStatus)(int *status);
+  // Charger input current in microamperes
+  int (*getInputCurrent)(int *microamps);
+  // Bitmask of enum battery_module_caps available after init(), may be NULL
+  uint32_t (*getCaps)(void);
+};
+
+extern const struct battery_module BATTERY_MODULE;
+
 __END_DECLS
@@ -10,9 +10,12 @@
 #include <android/binder_manager.h>
 #include <android/binder_process.h>
 
+#include <chrono>
+
 using ::aidl::vendor::samsung_ext::framework::battery::SmartCharge;
 
 int main() {
+  const auto start = std::chrono::steady_clock::now();
   ABinderProcess_setThreadPoolMaxThreadCount(8);
   ABinderProcess_startThreadPool();
   std::shared_ptr<SmartCharge> smartcharge =
@@ -23,6 +26,12 @@ int main() {
   binder_status_t status = AServiceManager_addService(
       smartcharge->asBinder().get(), instance.c_str());
   CHECK(status == STATUS_OK);
+  LOG(INFO) << "Registered in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start).count()
+            << "ms";
+  // Clients can connect already, calls made meanwhile are queued
+  smartcharge->initAsync();
 
   ABinderProcess_joinThreadPool();
   return EXIT_FAILURE; // should not reach
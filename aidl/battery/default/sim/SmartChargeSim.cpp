@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2023 Royna (@roynatech2544 on GH)
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Runs ChargeController against a simulated battery for days of virtual time,
+// once per poll policy, and reports how well each keeps to the limits.
+//
+// Usage: smartcharge_sim [days] [upper] [lower|-1 for no restart] [seed]
+
+#include "ChargeController.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <utility>
+
+using namespace aidl::vendor::samsung_ext::framework::battery;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr int64_t kStepMs = 1000;
+constexpr int64_t kDayMs = 24 * 3600 * 1000LL;
+// The fuel gauge driver updates its reading at this interval
+constexpr int64_t kGaugeUpdateMs = 10 * 1000;
+// Same as SmartCharge::waitForEvent() with callbacks
+constexpr int64_t kFallbackMs = 60 * 1000;
+
+uint64_t cpuNs() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+class Battery {
+ public:
+  explicit Battery(uint32_t seed) : rng(seed) {}
+
+  void advance(int64_t nowMs) {
+    const int64_t dayMs = nowMs % kDayMs;
+    const bool night = dayMs < 7 * 3600 * 1000LL || dayMs >= 23 * 3600 * 1000LL;
+    double rate = 0;
+
+    // Plugged in overnight, plus the odd top-up during the day
+    if (night) {
+      plugged = true;
+      topUpEndMs = 0;
+    } else if (nowMs < topUpEndMs) {
+      plugged = true;
+    } else {
+      plugged = false;
+      if (std::uniform_real_distribution<>(0, 1)(rng) < kTopUpChance)
+        topUpEndMs = nowMs + std::uniform_int_distribution<int64_t>(20, 90)(rng) * 60000;
+    }
+    // Constant current until 80%, then tapering
+    if (plugged && chargable)
+      rate = kChargeRate * (level < 80 ? 1.0 : std::max(0.15, (100 - level) / 20));
+    // Usage drains on top, in bursts by day
+    rate -= night ? 0.01 : (nowMs / 600000) % 3 == 0 ? 0.35 : 0.05;
+    level = std::clamp(level + rate * kStepMs / 60000.0, 0.0, 100.0);
+
+    if (nowMs % kGaugeUpdateMs == 0) {
+      const int next = std::clamp(
+          static_cast<int>(std::floor(level + std::normal_distribution<>(0, kNoise)(rng))), 0, 100);
+      changed |= next != gauge || plugged != reportedPlugged;
+      gauge = next;
+      reportedPlugged = plugged;
+    }
+  }
+  // Whether the health HAL would have pushed an event since the last call
+  bool takeEvent() { return std::exchange(changed, false); }
+
+  double level = 50;
+  int gauge = 50;
+  bool plugged = false, chargable = true;
+
+ private:
+  static constexpr double kChargeRate = 1.2;
+  // Gauge reading error in percent, makes it flip between steps
+  static constexpr double kNoise = 0.15;
+  // Per simulated second of the day
+  static constexpr double kTopUpChance = 1.0 / (4 * 3600);
+  std::mt19937 rng;
+  int64_t topUpEndMs = 0;
+  bool changed = false, reportedPlugged = false;
+};
+
+class SimClock : public Clock {
+ public:
+  int64_t nowMs() override { return now; }
+  int64_t now = 0;
+};
+
+class SimSource : public CapacitySource {
+ public:
+  explicit SimSource(Battery& battery) : battery(battery) {}
+  int readCapacity() override {
+    ++reads;
+    return battery.gauge;
+  }
+  Battery& battery;
+  uint64_t reads = 0;
+};
+
+class SimSwitch : public ChargeSwitch {
+ public:
+  explicit SimSwitch(Battery& battery) : battery(battery) {}
+  void setChargable(bool enable) override {
+    flips += battery.chargable != enable;
+    battery.chargable = enable;
+  }
+  Battery& battery;
+  uint64_t flips = 0;
+};
+
+struct Policy {
+  const char* name;
+  PollPolicy poll;
+  // Woken by health HAL events, as with callbacks registered
+  bool events;
+};
+
+struct Result {
+  double maxOvershoot = 0, maxUndershoot = 0;
+  // Percent-minutes above the upper limit while plugged in
+  double overshootArea = 0;
+  uint64_t wakeups = 0, reads = 0, flips = 0, cpuNs = 0;
+};
+
+Result run(const Policy& policy, const ChargeConfig& cfg, int days, uint32_t seed) {
+  Battery battery(seed);
+  SimClock clock;
+  SimSource source(battery);
+  SimSwitch chargeSwitch(battery);
+  ChargeController controller(source, chargeSwitch, clock, policy.poll);
+  Result res;
+  int64_t nextWakeMs = 0;
+
+  while (clock.now < days * kDayMs) {
+    clock.now += kStepMs;
+    battery.advance(clock.now);
+    if (battery.plugged) {
+      const double over = battery.level - (cfg.upper + 1);
+      res.maxOvershoot = std::max(res.maxOvershoot, over);
+      if (over > 0)
+        res.overshootArea += over * kStepMs / 60000.0;
+      if (cfg.restart && !battery.chargable)
+        res.maxUndershoot = std::max(res.maxUndershoot, cfg.lower - battery.level);
+    }
+
+    const bool event = policy.events && battery.takeEvent();
+    if (!event && clock.now < nextWakeMs)
+      continue;
+    ++res.wakeups;
+    const uint64_t cpu = cpuNs();
+    controller.step(cfg, event ? battery.gauge : -1);
+    res.cpuNs += cpuNs() - cpu;
+    if (!policy.events)
+      nextWakeMs = clock.now + controller.pollDelay().count();
+    else if (battery.plugged)
+      nextWakeMs = clock.now + kFallbackMs;
+    else
+      // Plugging in is an event
+      nextWakeMs = INT64_MAX;
+  }
+  res.reads = source.reads;
+  res.flips = chargeSwitch.flips;
+  return res;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? atoi(argv[1]) : 7;
+  const int lower = argc > 3 ? atoi(argv[3]) : 70;
+  const ChargeConfig cfg = {
+      .upper = argc > 2 ? atoi(argv[2]) : 80,
+      .lower = lower,
+      .restart = lower >= 0,
+  };
+  const uint32_t seed = argc > 4 ? strtoul(argv[4], nullptr, 0) : 1;
+  static const Policy kPolicies[] = {
+      {"poll 5s", {false, 5s, 5s}, false},
+      {"poll 30s", {false, 30s, 30s}, false},
+      {"predict", {true, 5s, 60s}, false},
+      {"events", {false, 5s, 5s}, true},
+  };
+
+  if (days <= 0 || cfg.upper <= 0 || cfg.upper > 100 || (cfg.restart && cfg.lower >= cfg.upper)) {
+    fprintf(stderr, "Usage: %s [days] [upper] [lower|-1] [seed]\n", argv[0]);
+    return 1;
+  }
+  printf("%d day(s), upper %d, lower %d, restart %d, seed %u\n", days, cfg.upper, cfg.lower,
+         cfg.restart, seed);
+  printf("%-9s %10s %10s %8s %8s %10s %8s %10s\n", "policy", "wakeups/d", "reads/d",
+         "toggles", "over %", "over %min", "under %", "cpu us/d");
+  for (const auto& p : kPolicies) {
+    const Result r = run(p, cfg, days, seed);
+    printf("%-9s %10" PRIu64 " %10" PRIu64 " %8" PRIu64 " %8.2f %10.1f %8.2f %10" PRIu64 "\n",
+           p.name, r.wakeups / days, r.reads / days, r.flips, r.maxOvershoot, r.overshootArea,
+           r.maxUndershoot, r.cpuNs / days / 1000);
+  }
+  return 0;
+}
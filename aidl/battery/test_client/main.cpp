@@ -5,11 +5,12 @@
 #include <SafeStoi.h>
 
 using aidl::vendor::samsung_ext::framework::battery::ISmartCharge;
+using aidl::vendor::samsung_ext::framework::battery::SmartChargeStatus;
 
 int main(int argc, const char **argv) {
   if (argc != 4) {
     fprintf(stderr, "Usage: %s [cmd num] [arg1] [arg2]\n", argv[0]);
-    fprintf(stderr, "           cmd_num -> 1: setChargeLimit, 2: activate\n");
+    fprintf(stderr, "           cmd_num -> 1: setChargeLimit, 2: activate, 3: getStatus\n");
     return 1;
   }
   auto svc = getServiceDefault<ISmartCharge>();
@@ -34,6 +35,13 @@ int main(int argc, const char **argv) {
     TEST_LOG2(svc, activate, !!arg2, !!arg3);
     break;
   }
+  case 3: {
+    SmartChargeStatus status;
+    auto rc = svc->getStatus(&status);
+    printf("getStatus: ok: %s %s\n", rc.isOk() ? "true" : "false",
+           rc.isOk() ? status.toString().c_str() : rc.getDescription().c_str());
+    break;
+  }
   default: {
     fprintf(stderr, "Unsupported cmd: %d\n", arg1);
     break;
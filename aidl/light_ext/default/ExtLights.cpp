@@ -17,7 +17,7 @@ namespace light {
 
 ndk::ScopedAStatus ExtLights::onPropsChanged(void) {
   if (svc) {
-    svc->handleBacklight_brightness(true, /*unused*/ 0);
+    svc->refreshBacklight();
     return ndk::ScopedAStatus::ok();
   } else {
     LOG(ERROR) << __func__ << "svc is NULL";
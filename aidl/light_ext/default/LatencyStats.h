@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+/*
+ * Latency counters with a log2 histogram, bucket i holds latencies below
+ * 2^i us. Lock-free, a concurrent dump may mix two updates.
+ */
+struct LatencyStats {
+    static constexpr size_t kBuckets = 16;
+    std::atomic_uint64_t count = 0, totalNs = 0, maxNs = 0;
+    std::array<std::atomic_uint64_t, kBuckets> buckets{};
+
+    void add(std::chrono::nanoseconds latency) {
+        const uint64_t ns = latency.count();
+        size_t bucket = 0;
+
+        while (bucket < kBuckets - 1 && ns / 1000 >= (1ULL << bucket)) bucket++;
+        count++;
+        totalNs += ns;
+        buckets[bucket]++;
+        uint64_t max = maxNs.load(std::memory_order_relaxed);
+        while (ns > max && !maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    // Upper bound in us of the bucket holding the given percentile
+    uint64_t percentileUs(unsigned percent) const {
+        uint64_t total = 0, seen = 0;
+
+        for (const auto& b : buckets) total += b;
+        for (size_t i = 0; i < kBuckets; i++) {
+            seen += buckets[i];
+            if (seen * 100 >= total * percent) return 1ULL << i;
+        }
+        return 1ULL << (kBuckets - 1);
+    }
+
+    void dump(int fd, const char* name) const {
+        const uint64_t n = count;
+
+        if (n == 0) return;
+        dprintf(fd,
+                "%s: %" PRIu64 ", avg %" PRIu64 " us, p50 <%" PRIu64 " us, p99 <%" PRIu64
+                " us, max %" PRIu64 " us\n",
+                name, n, totalNs / n / 1000, percentileUs(50), percentileUs(99), maxNs / 1000);
+    }
+};
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
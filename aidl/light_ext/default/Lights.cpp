@@ -6,10 +6,11 @@
 
 #define LOG_TAG "vendor.samsung_ext.hardware.lights-service"
 
-#include <android-base/stringprintf.h>
 #include <android-base/properties.h>
 
-#include <fstream>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
 #include <mutex>
 
 #include "Lights.h"
@@ -25,24 +26,6 @@ namespace android {
 namespace hardware {
 namespace light {
 
-/*
- * Write value to path and close file.
- */
-template <typename T>
-static void set(const std::string& path, const T& value) {
-    std::ofstream file(path);
-    file << value << std::endl;
-}
-
-template <typename T>
-static T get(const std::string& path, const T& def) {
-    std::ifstream file(path);
-    T result;
-
-    file >> result;
-    return file.fail() ? def : result;
-}
-
 using ::android::base::GetBoolProperty;
 using ::android::base::SetProperty;
 
@@ -62,6 +45,7 @@ Lights::Lights() {
 }
 
 ndk::ScopedAStatus Lights::setLightState(int32_t id, const HwLightState& state) {
+    const auto start = std::chrono::steady_clock::now();
     LightType type = static_cast<LightType>(id);
     auto it = mLights.find(type);
 
@@ -70,15 +54,23 @@ ndk::ScopedAStatus Lights::setLightState(int32_t id, const HwLightState& state)
     }
 
     /*
-     * Lock global mutex until light state is updated.
+     * Lock global mutex until light state is updated. Nodes are written
+     * asynchronously, this does not wait for the driver.
      */
     std::lock_guard<std::mutex> lock(mLock);
 
     it->second(state);
+    mSetStats.add(std::chrono::steady_clock::now() - start);
 
     return ndk::ScopedAStatus::ok();
 }
 
+void Lights::refreshBacklight() {
+    std::lock_guard<std::mutex> lock(mLock);
+
+    handleBacklight_brightness(true, /*unused*/ 0);
+}
+
 void Lights::handleBacklight_brightness(const bool fromExtHal, const uint32_t brightness_s) {
     static int32_t max_brightness;
     static std::once_flag once;
@@ -86,7 +78,7 @@ void Lights::handleBacklight_brightness(const bool fromExtHal, const uint32_t br
     int32_t brightness;
 
     std::call_once(once, [this]{ 
-         max_brightness = get(PANEL_MAX_BRIGHTNESS_NODE, MAX_INPUT_BRIGHTNESS);
+         max_brightness = mPanelMaxBrightness.read(MAX_INPUT_BRIGHTNESS);
          need_conversion = max_brightness != MAX_INPUT_BRIGHTNESS;
          sunlight_data.enabled = GetBoolProperty(SUNLIGHT_ENABLED_PROP, false);
     });
@@ -106,7 +98,7 @@ void Lights::handleBacklight_brightness(const bool fromExtHal, const uint32_t br
         if (brightness == -1) {
             // If brightness is -1 (Meaning not initialized), then better not set backlight to negative
             // cuz that... Just read it from sysfs
-            brightness = get(PANEL_BRIGHTNESS_NODE, -1);
+            brightness = mPanelBrightness.read(-1);
             if (brightness == -1) {
                 // OK Kys
                 return;
@@ -118,7 +110,7 @@ void Lights::handleBacklight_brightness(const bool fromExtHal, const uint32_t br
         brightness *= SUNLIGHT_RATIO;
     }
 
-    set(PANEL_BRIGHTNESS_NODE, brightness);
+    mPanelBrightness.post(brightness);
 }
 
 void Lights::handleBacklight(const HwLightState& state) {
@@ -133,7 +125,7 @@ void Lights::handleButtons(const HwLightState& state) {
     uint32_t brightness = (state.color & COLOR_MASK) ? 1 : 0;
 #endif
 
-    set(BUTTON_BRIGHTNESS_NODE, brightness);
+    mButtonBrightness.post(brightness);
 }
 #endif
 
@@ -180,7 +172,7 @@ void Lights::setNotificationLED() {
         adjusted_brightness = LED_BRIGHTNESS_BATTERY;
         state = mBatteryState;
     } else {
-        set(LED_BLINK_NODE, "0x00000000 0 0");
+        mLedBlink.write("0x00000000 0 0");
         return;
     }
 
@@ -190,12 +182,14 @@ void Lights::setNotificationLED() {
     }
 
     state.color = calibrateColor(state.color & COLOR_MASK, adjusted_brightness);
-    set(LED_BLINK_NODE, ::android::base::StringPrintf("0x%08x %d %d", state.color, state.flashOnMs,
-                                                    state.flashOffMs));
+    char blink[40];
+    snprintf(blink, sizeof(blink), "0x%08x %d %d", state.color, state.flashOnMs,
+             state.flashOffMs);
+    mLedBlink.write(blink);
 
 #ifdef LED_BLN_NODE
     if (bln) {
-        set(LED_BLN_NODE, (state.color & COLOR_MASK) ? 1 : 0);
+        mLedBln.post((state.color & COLOR_MASK) ? 1 : 0);
     }
 #endif /* LED_BLN_NODE */
 }
@@ -220,6 +214,23 @@ ndk::ScopedAStatus Lights::getLights(std::vector<HwLight> *_aidl_return) {
     return ndk::ScopedAStatus::ok();
 }
 
+binder_status_t Lights::dump(int fd, const char** /* args */, uint32_t /* numArgs */) {
+    mSetStats.dump(fd, "setLightState");
+    mPanelBrightness.dump(fd, PANEL_BRIGHTNESS_NODE);
+#ifdef BUTTON_BRIGHTNESS_NODE
+    mButtonBrightness.dump(fd, BUTTON_BRIGHTNESS_NODE);
+#endif /* BUTTON_BRIGHTNESS_NODE */
+#ifdef LED_BLN_NODE
+    mLedBln.dump(fd, LED_BLN_NODE);
+#endif /* LED_BLN_NODE */
+#ifdef LED_BLINK_NODE
+    std::lock_guard<std::mutex> lock(mLock);
+    dprintf(fd, "%s: %" PRIu64 " writes, %" PRIu64 " skipped as unchanged\n", LED_BLINK_NODE,
+            mLedBlink.writes(), mLedBlink.skipped());
+#endif /* LED_BLINK_NODE */
+    return STATUS_OK;
+}
+
 uint32_t Lights::rgbToBrightness(const HwLightState& state) {
     uint32_t color = state.color & COLOR_MASK;
 
@@ -8,6 +8,9 @@
 
 #include <aidl/android/hardware/light/BnLights.h>
 #include <unordered_map>
+#include "LatencyStats.h"
+#include "NodeWriter.h"
+#include "SysfsNode.h"
 #include "samsung_lights.h"
 
 using ::aidl::android::hardware::light::HwLightState;
@@ -24,10 +27,13 @@ public:
 
     ndk::ScopedAStatus setLightState(int32_t id, const HwLightState& state) override;
     ndk::ScopedAStatus getLights(std::vector<HwLight> *_aidl_return) override;
+    binder_status_t dump(int fd, const char** args, uint32_t numArgs) override;
 
-    void handleBacklight_brightness(const bool fromExtHal, const uint32_t brightness);
+    // Reapply the backlight after the sunlight property changed
+    void refreshBacklight();
 
 private:
+    void handleBacklight_brightness(const bool fromExtHal, const uint32_t brightness);
     void handleBacklight(const HwLightState& state);
 #ifdef BUTTON_BRIGHTNESS_NODE
     void handleButtons(const HwLightState& state);
@@ -49,6 +55,24 @@ private:
     std::mutex mLock;
     std::unordered_map<LightType, std::function<void(const HwLightState&)>> mLights;
 
+    // Written from their own threads, binder calls only post to them
+    NodeWriter mPanelBrightness{PANEL_BRIGHTNESS_NODE};
+#ifdef BUTTON_BRIGHTNESS_NODE
+    NodeWriter mButtonBrightness{BUTTON_BRIGHTNESS_NODE};
+#endif /* BUTTON_BRIGHTNESS_NODE */
+#ifdef LED_BLN_NODE
+    NodeWriter mLedBln{LED_BLN_NODE};
+#endif /* LED_BLN_NODE */
+    // Read once, under mLock
+    SysfsNode mPanelMaxBrightness{PANEL_MAX_BRIGHTNESS_NODE};
+#ifdef LED_BLINK_NODE
+    // Written under mLock. Rarely written, and not a single number.
+    SysfsNode mLedBlink{LED_BLINK_NODE};
+#endif /* LED_BLINK_NODE */
+
+    // From entering setLightState until the new state is handed over
+    LatencyStats mSetStats;
+
     struct {
        bool enabled;
        int32_t requested_brightness = -1;
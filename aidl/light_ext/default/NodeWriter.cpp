@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "NodeWriter.h"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <string>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+NodeWriter::NodeWriter(const char* path) : mNode(path), mThread(&NodeWriter::writerLoop, this) {}
+
+NodeWriter::~NodeWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mWakeLock);
+        mStop = true;
+    }
+    mWakeCv.notify_one();
+    mThread.join();
+}
+
+void NodeWriter::post(int32_t value) {
+    mLastPosted = value;
+    mPosted++;
+    if (mPending.exchange(value) != kEmpty) {
+        // The writer has not taken the previous one yet, and will take this instead
+        mDropped++;
+        return;
+    }
+    // The writer may be asleep. Taking the lock orders this with its check
+    // of mPending, so the wakeup cannot be missed.
+    { std::lock_guard<std::mutex> lock(mWakeLock); }
+    mWakeCv.notify_one();
+}
+
+int32_t NodeWriter::read(int32_t def) {
+    const int64_t last = mLastPosted;
+
+    if (last != kEmpty) return last;
+    std::lock_guard<std::mutex> lock(mNodeLock);
+    return mNode.read(def);
+}
+
+void NodeWriter::writerLoop() {
+    while (true) {
+        int64_t value;
+        {
+            std::unique_lock<std::mutex> lock(mWakeLock);
+            mWakeCv.wait(lock, [this] { return mStop || mPending != kEmpty; });
+            // Values posted before stopping are still written
+            value = mPending.exchange(kEmpty);
+            if (value == kEmpty) break;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mNodeLock);
+            mNode.write(static_cast<int32_t>(value));
+        }
+        mWriteStats.add(std::chrono::steady_clock::now() - start);
+    }
+}
+
+void NodeWriter::dump(int fd, const char* name) {
+    uint64_t writes, skipped;
+    {
+        std::lock_guard<std::mutex> lock(mNodeLock);
+        writes = mNode.writes();
+        skipped = mNode.skipped();
+    }
+    dprintf(fd,
+            "%s: %" PRIu64 " posted, %" PRIu64 " dropped for a newer value, %" PRIu64
+            " writes, %" PRIu64 " skipped as unchanged\n",
+            name, mPosted.load(), mDropped.load(), writes, skipped);
+    mWriteStats.dump(fd, (std::string(name) + " write").c_str());
+}
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
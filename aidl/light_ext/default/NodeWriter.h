@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "LatencyStats.h"
+#include "SysfsNode.h"
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+/*
+ * Writes a SysfsNode from its own thread, so callers never wait on the
+ * driver. post() only stores the value in a single slot and wakes the
+ * thread if it is idle. The thread writes whatever is newest when it gets
+ * to it, values posted meanwhile are dropped.
+ */
+class NodeWriter {
+public:
+    explicit NodeWriter(const char* path);
+    ~NodeWriter();
+
+    NodeWriter(const NodeWriter&) = delete;
+    NodeWriter& operator=(const NodeWriter&) = delete;
+
+    void post(int32_t value);
+    // Last value posted, or read from the node if none was
+    int32_t read(int32_t def);
+
+    void dump(int fd, const char* name);
+
+private:
+    static constexpr int64_t kEmpty = INT64_MIN;
+
+    void writerLoop();
+
+    // Latest value not yet taken by the writer, kEmpty if none
+    std::atomic_int64_t mPending{kEmpty};
+    std::atomic_int64_t mLastPosted{kEmpty};
+    // Only for sleeping and waking the writer, post() takes it only when
+    // the slot was empty
+    std::mutex mWakeLock;
+    std::condition_variable mWakeCv;
+    bool mStop = false;
+
+    // Held by the writer while it writes, and by read()
+    std::mutex mNodeLock;
+    SysfsNode mNode;
+
+    std::atomic_uint64_t mPosted = 0, mDropped = 0;
+    LatencyStats mWriteStats;
+    std::thread mThread;
+};
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
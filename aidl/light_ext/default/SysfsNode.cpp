@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "vendor.samsung_ext.hardware.lights-service"
+
+#include "SysfsNode.h"
+
+#include <android-base/logging.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+SysfsNode::~SysfsNode() {
+    if (mFd >= 0) close(mFd);
+}
+
+bool SysfsNode::ensureOpen() {
+    if (mFd >= 0) return true;
+    // Some nodes are read only, such as max_brightness
+    mFd = open(mPath, O_RDWR | O_CLOEXEC);
+    if (mFd < 0 && errno == EACCES) mFd = open(mPath, O_RDONLY | O_CLOEXEC);
+    if (mFd < 0) {
+        PLOG(ERROR) << "Failed to open " << mPath;
+        return false;
+    }
+    return true;
+}
+
+bool SysfsNode::writeBuf(const char* buf, size_t len) {
+    // len excludes the trailing newline, which buf holds
+    if (mHaveLast && len == mLastLen && memcmp(buf, mLast, len) == 0) {
+        ++mSkipped;
+        return true;
+    }
+    if (!ensureOpen()) return false;
+    if (pwrite(mFd, buf, len + 1, 0) != static_cast<ssize_t>(len + 1)) {
+        PLOG(ERROR) << "Failed to write " << mPath;
+        // Reopen next time, and do not skip a retry of the same value
+        close(mFd);
+        mFd = -1;
+        mHaveLast = false;
+        return false;
+    }
+    ++mWrites;
+    if (len <= sizeof(mLast)) {
+        memcpy(mLast, buf, len);
+        mLastLen = len;
+        mHaveLast = true;
+    } else {
+        mHaveLast = false;
+    }
+    return true;
+}
+
+bool SysfsNode::write(int32_t value) {
+    char buf[16];
+    int len = snprintf(buf, sizeof(buf), "%" PRId32 "\n", value);
+
+    return writeBuf(buf, len - 1);
+}
+
+bool SysfsNode::write(const char* value) {
+    char buf[sizeof(mLast) + 1];
+    size_t len = strlen(value);
+
+    if (len >= sizeof(buf)) {
+        LOG(ERROR) << "Value too long for " << mPath << ": " << value;
+        return false;
+    }
+    memcpy(buf, value, len);
+    buf[len] = '\n';
+    return writeBuf(buf, len);
+}
+
+int32_t SysfsNode::read(int32_t def) {
+    char buf[16];
+    char* end;
+    ssize_t len;
+    long value;
+
+    if (!ensureOpen()) return def;
+    len = pread(mFd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) return def;
+    buf[len] = '\0';
+    value = strtol(buf, &end, 10);
+    return end == buf ? def : value;
+}
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
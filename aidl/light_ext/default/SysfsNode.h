@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2021 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace aidl {
+namespace android {
+namespace hardware {
+namespace light {
+
+/*
+ * A sysfs attribute kept open for the lifetime of the service. Values are
+ * formatted on the stack and written with pwrite(), and a value equal to the
+ * last one written is not written again. This service must be the only
+ * writer of the node for the latter to hold.
+ */
+class SysfsNode {
+public:
+    explicit SysfsNode(const char* path) : mPath(path) {}
+    ~SysfsNode();
+
+    SysfsNode(const SysfsNode&) = delete;
+    SysfsNode& operator=(const SysfsNode&) = delete;
+
+    // Write value followed by a newline, returns false on failure
+    bool write(int32_t value);
+    bool write(const char* value);
+    // Read an integer, or def on failure
+    int32_t read(int32_t def);
+
+    uint64_t writes() const { return mWrites; }
+    uint64_t skipped() const { return mSkipped; }
+
+private:
+    bool ensureOpen();
+    bool writeBuf(const char* buf, size_t len);
+
+    const char* mPath;
+    int mFd = -1;
+    // Last value written, without the newline
+    char mLast[64];
+    size_t mLastLen = 0;
+    bool mHaveLast = false;
+    uint64_t mWrites = 0;
+    uint64_t mSkipped = 0;
+};
+
+} // namespace light
+} // namespace hardware
+} // namespace android
+} // namespace aidl
@@ -38,6 +38,8 @@ import com.android.settingslib.widget.OnMainSwitchChangeListener
 import com.royna.smartcharge.R
 
 import vendor.samsung_ext.framework.battery.ISmartCharge
+import vendor.samsung_ext.framework.battery.ISmartChargeCallback
+import vendor.samsung_ext.framework.battery.SmartChargeStatus
 
 import java.lang.IllegalArgumentException
 import java.lang.IllegalStateException
@@ -57,6 +59,13 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnMainSwitchChangeListen
         ServiceManager.waitForDeclaredService(
         "vendor.samsung_ext.framework.battery.ISmartCharge/default"))
     private lateinit var mSharedPreferences : SharedPreferences
+    // Set while the UI follows the service, so it is not sent back to it
+    private var mSyncing = false
+    private val mCallback = object : ISmartChargeCallback.Stub() {
+        override fun onStatusChanged(status: SmartChargeStatus) {
+            mMainHandler.post { syncWithService(status) }
+        }
+    }
 
     override fun onCreatePreferences(savedInstanceState: Bundle?, rootKey: String?) {
         addPreferencesFromResource(R.xml.smartcharge_settings)
@@ -68,30 +77,44 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnMainSwitchChangeListen
         val mEnabledGlobal = mSharedPreferences.getBoolean(PREF_SMTCHG_ENABLE, false)
         mMainSwitch.setChecked(mEnabledGlobal)
         mRestartEnableSwitch.isChecked = mSharedPreferences.getBoolean(PREF_ENABLE_RESTART, false)
-	mRestartEnableSwitch.isEnabled = !mEnabledGlobal
         mStopBar.value = mSharedPreferences.getInt(PREF_STOP_CFG, 80)
 	mStopBar.min = MIN
-	mStopBar.isEnabled = !mEnabledGlobal
         mRestartBar.value = mSharedPreferences.getInt(PREF_RESTART_CFG, 70)
 	mRestartBar.min = MIN
-        mRestartBar.isEnabled = mRestartEnableSwitch.isChecked && !mEnabledGlobal
+        mRestartBar.isEnabled = mRestartEnableSwitch.isChecked
         mConfig = if (mRestartEnableSwitch.isChecked) {Config.STOP_RESTART} else {Config.STOP}
+        // The service knows best, the preferences only fill in while it is unreachable
+        runCatching { mService?.status }.getOrNull()?.let { syncWithService(it) }
 
         mMainSwitch.addOnSwitchChangeListener(this)
         mRestartEnableSwitch.setOnPreferenceChangeListener { _, new ->
-            mConfig = if (new as Boolean) {
+            val config = if (new as Boolean) {
                 Config.STOP_RESTART
             } else {
                 Config.STOP
             }
+            val mStop = mSharedPreferences.getInt(PREF_STOP_CFG, 80)
+            var mRestart = mSharedPreferences.getInt(PREF_RESTART_CFG, 70)
+            val mFixRestart = new && mStop <= mRestart
+            if (mFixRestart)
+                mRestart = (mStop - MIN) / 2 + MIN
+            // The running service takes the new mode as is, kept only if it does
+            if (mMainSwitch.isChecked && !applyToService {
+                    if (new) {
+                        applyLimits(config, mStop, mRestart)
+                        mService?.activate(true, true)
+                    } else {
+                        mService?.activate(true, false)
+                        applyLimits(config, mStop)
+                    }
+                })
+                return@setOnPreferenceChangeListener false
+            mConfig = config
             mRestartBar.isEnabled = new
-	    if (new) {
-                 val mStop = mSharedPreferences.getInt(PREF_STOP_CFG, 80)
-                 if (mStop <= mSharedPreferences.getInt(PREF_RESTART_CFG, 70)) { 
-                      mMainHandler.post { mRestartBar.value = (mStop - MIN) / 2 + MIN }
-                      mSharedPreferences.edit().putInt(PREF_RESTART_CFG, mRestartBar.value).apply()
-                      updateSeekbarTitles(mapOf(mRestartBar.key to mRestartBar.value))
-                 }
+            if (mFixRestart) {
+                mMainHandler.post { mRestartBar.value = mRestart }
+                mSharedPreferences.edit().putInt(PREF_RESTART_CFG, mRestart).apply()
+                updateSeekbarTitles(mapOf(mRestartBar.key to mRestart))
             }
             mSharedPreferences.edit().putBoolean(PREF_ENABLE_RESTART, new).apply()
             true
@@ -99,8 +122,17 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnMainSwitchChangeListen
         val kSeekBarListener = Preference.OnPreferenceChangeListener { preference, newValue ->
             when (preference.key) {
                 PREF_RESTART_CFG, PREF_STOP_CFG -> {
-                    mSharedPreferences.edit().putInt(preference.key, newValue as Int).apply()
-                    updateSeekbarTitles(mapOf(preference.key to newValue))
+                    val value = newValue as Int
+                    // Kept only if the running service takes it
+                    if (mMainSwitch.isChecked && !applyToService {
+                            if (preference.key == PREF_STOP_CFG)
+                                applyLimits(stop = value)
+                            else
+                                applyLimits(restart = value)
+                        })
+                        return@OnPreferenceChangeListener false
+                    mSharedPreferences.edit().putInt(preference.key, value).apply()
+                    updateSeekbarTitles(mapOf(preference.key to value))
                 }
                 else -> return@OnPreferenceChangeListener false
             }
@@ -111,6 +143,42 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnMainSwitchChangeListen
         updateSeekbarTitles()
     }
 
+    override fun onResume() {
+        super.onResume()
+        runCatching { mService?.registerCallback(mCallback) }.onFailure { Log.w(TAG, it) }
+    }
+
+    override fun onPause() {
+        runCatching { mService?.unregisterCallback(mCallback) }.onFailure { Log.w(TAG, it) }
+        super.onPause()
+    }
+
+    private fun syncWithService(status: SmartChargeStatus) {
+        mSyncing = true
+        val edit = mSharedPreferences.edit()
+        // It stops on its own on errors
+        if (mMainSwitch.isChecked != status.running)
+            mMainSwitch.setChecked(status.running)
+        edit.putBoolean(PREF_SMTCHG_ENABLE, status.running)
+        if (status.upper >= MIN) {
+            mStopBar.value = status.upper
+            edit.putInt(PREF_STOP_CFG, status.upper)
+        }
+        if (status.lower >= MIN) {
+            mRestartBar.value = status.lower
+            edit.putInt(PREF_RESTART_CFG, status.lower)
+        }
+        if (status.running) {
+            mRestartEnableSwitch.isChecked = status.restart
+            mRestartBar.isEnabled = status.restart
+            mConfig = if (status.restart) {Config.STOP_RESTART} else {Config.STOP}
+            edit.putBoolean(PREF_ENABLE_RESTART, status.restart)
+        }
+        edit.apply()
+        updateSeekbarTitles(mapOf(mStopBar.key to mStopBar.value, mRestartBar.key to mRestartBar.value))
+        mSyncing = false
+    }
+
     private fun SharedPreferences.getIntZ(value: String): Int {
         getInt(value, -1).apply {
             if (this == -1)
@@ -138,17 +206,38 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnMainSwitchChangeListen
         }
     }
 
+    private fun applyLimits(config: Config = mConfig, stop: Int? = null, restart: Int? = null) {
+        val mStop = stop ?: mSharedPreferences.getIntZ(PREF_STOP_CFG)
+        when (config) {
+            Config.STOP_RESTART -> {
+                try { mService?.setChargeLimit(mStop,
+                    restart ?: mSharedPreferences.getIntZ(PREF_RESTART_CFG)) } catch (e: IllegalArgumentException) { throw IllegalStateException() }
+            }
+            Config.STOP -> {
+                mService?.setChargeLimit(mStop,-1)
+            }
+        }
+    }
+
+    // Changes while enabled apply to the running service, without restarting it.
+    // Returns false if it rejected them, the UI then follows what it has.
+    private fun applyToService(block: () -> Unit): Boolean {
+        return runCatching(block).onFailure {
+            Log.w(TAG, it)
+            mMainHandler.post {
+                Toast.makeText(requireContext(),
+                    R.string.smart_charge_invalid_config, Toast.LENGTH_SHORT).show()
+                runCatching { mService?.status }.getOrNull()?.let { syncWithService(it) }
+            }
+        }.isSuccess
+    }
+
     override fun onSwitchChanged(switchView: Switch, isChecked: Boolean) {
+        if (mSyncing)
+            return
         runCatching {
-            if (isChecked) { when (mConfig) {
-                Config.STOP_RESTART -> {
-                    try { mService?.setChargeLimit(mSharedPreferences.getIntZ(PREF_STOP_CFG),
-                        mSharedPreferences.getIntZ(PREF_RESTART_CFG)) } catch (e: IllegalArgumentException) { throw IllegalStateException() }
-                }
-                Config.STOP -> {
-                    mService?.setChargeLimit(mSharedPreferences.getIntZ(PREF_STOP_CFG),-1)
-                }
-            }}
+            if (isChecked)
+                applyLimits()
             mService?.activate(isChecked, mSharedPreferences.getBoolean(PREF_ENABLE_RESTART, false))
         }.onFailure {
             when (it) {
@@ -173,9 +262,6 @@ class SmartChargeFragment : PreferenceFragmentCompat(), OnMainSwitchChangeListen
             }
         }.onSuccess {
             mSharedPreferences.edit().putBoolean(PREF_SMTCHG_ENABLE, isChecked).apply()
-            mStopBar.isEnabled = !isChecked
-	    mRestartEnableSwitch.isEnabled = !isChecked
-            mRestartBar.isEnabled = mRestartEnableSwitch.isChecked && !isChecked
         }
     }
 
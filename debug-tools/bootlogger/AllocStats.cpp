@@ -0,0 +1,45 @@
+#include <cstdlib>
+#include <new>
+
+#include "LoggerInternal.h"
+
+#ifdef LOGGER_ALLOC_STATS
+
+// Debug only, every allocation of the process goes through here
+static thread_local uint64_t allocCount;
+
+static void *countedAlloc(std::size_t size) {
+  void *ptr = malloc(size ? size : 1);
+  if (ptr)
+    ++allocCount;
+  return ptr;
+}
+
+static void *countedAllocOrDie(std::size_t size) {
+  void *ptr = countedAlloc(size);
+  // Built without exceptions, there is nothing better to do
+  if (!ptr)
+    abort();
+  return ptr;
+}
+
+void *operator new(std::size_t size) { return countedAllocOrDie(size); }
+void *operator new[](std::size_t size) { return countedAllocOrDie(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return countedAlloc(size);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return countedAlloc(size);
+}
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { free(ptr); }
+
+uint64_t getThreadAllocCount() { return allocCount; }
+
+#else
+
+uint64_t getThreadAllocCount() { return 0; }
+
+#endif
@@ -1,7 +1,9 @@
 #include <array>
+#include <cctype>
 #include <regex>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "LoggerInternal.h"
@@ -203,3 +205,79 @@ bool writeAllowRules(const AvcContext &ctx, std::string &out) {
   }
   return false;
 }
+
+// Matches R"(avc:\s+denied\s+\{(\s\w+)+\s\}\sfor\s)" at [sv], without std::regex
+// as it allocates for every search
+static bool matchAvcDenial(std::string_view sv) {
+  auto isSpace = [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+  auto isWord = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+  auto literal = [&](std::string_view lit) {
+    if (sv.substr(0, lit.size()) != lit)
+      return false;
+    sv.remove_prefix(lit.size());
+    return true;
+  };
+  auto spaces = [&](bool many) {
+    size_t n = 0;
+    while (n < sv.size() && isSpace(sv[n]) && (many || n == 0))
+      ++n;
+    sv.remove_prefix(n);
+    return n > 0;
+  };
+
+  if (!literal("avc:") || !spaces(true) || !literal("denied") || !spaces(true) || !literal("{"))
+    return false;
+  // One or more " word", then " } for "
+  int words = 0;
+  while (sv.size() >= 2 && isSpace(sv[0]) && isWord(sv[1])) {
+    sv.remove_prefix(1);
+    while (!sv.empty() && isWord(sv.front()))
+      sv.remove_prefix(1);
+    ++words;
+  }
+  return words > 0 && spaces(false) && literal("}") && spaces(false) && literal("for") &&
+         spaces(false);
+}
+
+bool isAvcDenial(std::string_view line) {
+  // Matches "avc: denied { ioctl } for comm=..." for example
+  for (size_t idx = line.find("avc:"); idx != std::string_view::npos;
+       idx = line.find("avc:", idx + 1)) {
+    if (matchAvcDenial(line.substr(idx)))
+      return line.find("untrusted_app") == std::string_view::npos;
+  }
+  return false;
+}
+
+void mergeAvcContexts(AvcContexts &vec) {
+  // Same as merging each pair with operator+=, without comparing every pair
+  std::unordered_map<std::string, size_t> first;
+  std::string key;
+
+  for (size_t i = 0; i < vec.size(); ++i) {
+    auto &ctx = vec[i];
+    if (ctx.stale)
+      continue;
+    key = std::to_string(ctx.granted) + ctx.scontext + '\0' + ctx.tcontext + '\0' + ctx.tclass;
+    auto it = first.find(key);
+    if (it == first.end())
+      first.emplace(key, i);
+    else
+      vec[it->second] += ctx;
+  }
+  vec.erase(std::remove_if(vec.begin(), vec.end(), [](const auto &c) { return c.stale; }),
+            vec.end());
+}
+
+std::vector<std::string> makeAllowRules(AvcContexts &vec) {
+  std::vector<std::string> allowrules;
+
+  mergeAvcContexts(vec);
+  for (const auto &e : vec) {
+    std::string line;
+    if (writeAllowRules(e, line))
+      allowrules.emplace_back(line);
+  }
+  eraseDuplicates(allowrules);
+  return allowrules;
+}
@@ -0,0 +1,203 @@
+#include <android-base/parseint.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LoggerInternal.h"
+
+using android::base::ParseInt;
+
+// Chunks are at least this large, and there are a few per thread to balance load
+static constexpr size_t kMinChunkSize = 1 << 20;
+static constexpr int kChunksPerThread = 4;
+// Merge a thread's contexts every this many new ones, to bound memory
+static constexpr size_t kMergeEvery = 4096;
+
+struct MappedFile {
+  std::string path;
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+// Line aligned range of a file
+struct Chunk {
+  const MappedFile *file;
+  size_t begin, end;
+};
+
+struct WorkerResult {
+  AvcContexts contexts;
+  uint64_t lines = 0, denials = 0, failed = 0;
+  size_t unmerged = 0;
+};
+
+static bool mapFile(const char *path, MappedFile &out) {
+  struct stat st {};
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "Cannot open '%s': %s\n", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  out.path = path;
+  out.size = st.st_size;
+  if (out.size > 0) {
+    void *addr = mmap(nullptr, out.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      fprintf(stderr, "Cannot map '%s': %s\n", path, strerror(errno));
+      close(fd);
+      return false;
+    }
+    madvise(addr, out.size, MADV_SEQUENTIAL);
+    out.data = static_cast<const char *>(addr);
+  }
+  // The mapping stays valid
+  close(fd);
+  return true;
+}
+
+// Split [file] into chunks ending right after a new line
+static void splitFile(const MappedFile &file, size_t chunkSize, std::vector<Chunk> &out) {
+  size_t begin = 0;
+
+  while (begin < file.size) {
+    size_t end = std::min(file.size, begin + chunkSize);
+    if (end < file.size) {
+      const void *nl = memchr(file.data + end, '\n', file.size - end);
+      end = nl ? static_cast<const char *>(nl) - file.data + 1 : file.size;
+    }
+    out.push_back({&file, begin, end});
+    begin = end;
+  }
+}
+
+static void analyzeChunk(const Chunk &chunk, WorkerResult &result, std::string &line) {
+  const char *pos = chunk.file->data + chunk.begin;
+  const char *const end = chunk.file->data + chunk.end;
+
+  while (pos < end) {
+    const char *nl = static_cast<const char *>(memchr(pos, '\n', end - pos));
+    const char *eol = nl ? nl : end;
+    ++result.lines;
+    // Only build a string for denials
+    if (isAvcDenial(std::string_view(pos, eol - pos))) {
+      line.assign(pos, eol);
+      ++result.denials;
+      if (!parseOneAvcContext(line, result.contexts))
+        ++result.failed;
+      // Most denials are repeats, merging keeps few contexts around
+      if (++result.unmerged == kMergeEvery) {
+        mergeAvcContexts(result.contexts);
+        result.unmerged = 0;
+      }
+    }
+    pos = eol + 1;
+  }
+}
+
+static void analyzeUsage(const char *argv0) {
+  fprintf(stderr, "Usage: %s analyze [-o output] [-j threads] <log files...>\n", argv0);
+  fprintf(stderr, "  Generates sepolicy allow rules from AVC denials in dmesg/logcat dumps\n");
+  fprintf(stderr, "  Rules are written to stdout, unless -o is given\n");
+}
+
+int analyzeMain(int argc, const char **argv) {
+  const char *argv0 = argv[0];
+  const char *output = nullptr;
+  int threads = std::max(1U, std::thread::hardware_concurrency());
+  std::vector<MappedFile> files;
+  std::vector<Chunk> chunks;
+  size_t total = 0;
+  int i;
+
+  // Skip program name and subcommand
+  argc -= 2;
+  argv += 2;
+  for (i = 0; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    if (strcmp(argv[i], "-o") == 0) {
+      output = argv[i + 1];
+    } else if (strcmp(argv[i], "-j") != 0 || !ParseInt(argv[i + 1], &threads, 1, 1024)) {
+      analyzeUsage(argv0);
+      return EXIT_FAILURE;
+    }
+  }
+  if (i >= argc) {
+    analyzeUsage(argv0);
+    return EXIT_FAILURE;
+  }
+  // Reserved up front, chunks point into it
+  files.reserve(argc - i);
+  for (; i < argc; ++i) {
+    MappedFile file;
+    if (!mapFile(argv[i], file))
+      return EXIT_FAILURE;
+    total += file.size;
+    files.emplace_back(file);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  const size_t chunkSize = std::max(kMinChunkSize, total / (threads * kChunksPerThread) + 1);
+  for (const auto &f : files)
+    splitFile(f, chunkSize, chunks);
+  threads = std::min<int>(threads, std::max<size_t>(1, chunks.size()));
+
+  // Workers take chunks in order, each aggregates on its own
+  std::vector<WorkerResult> results(threads);
+  std::vector<std::thread> workers;
+  std::atomic_size_t next = 0;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      std::string line;
+      for (size_t c; (c = next++) < chunks.size();)
+        analyzeChunk(chunks[c], results[t], line);
+      mergeAvcContexts(results[t].contexts);
+    });
+  }
+  for (auto &w : workers)
+    w.join();
+
+  WorkerResult merged;
+  for (auto &r : results) {
+    merged.lines += r.lines;
+    merged.denials += r.denials;
+    merged.failed += r.failed;
+    std::move(r.contexts.begin(), r.contexts.end(), std::back_inserter(merged.contexts));
+  }
+  const auto rules = makeAllowRules(merged.contexts);
+  const std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+  FILE *out = output ? fopen(output, "we") : stdout;
+  if (!out) {
+    fprintf(stderr, "Cannot open '%s': %s\n", output, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  for (const auto &r : rules)
+    fputs(r.c_str(), out);
+  if (out != stdout)
+    fclose(out);
+
+  fprintf(stderr,
+          "%zu file(s), %.1f MB, %" PRIu64 " lines, %" PRIu64 " denials (%" PRIu64
+          " unparsable), %zu rules\n",
+          files.size(), total / 1e6, merged.lines, merged.denials, merged.failed, rules.size());
+  fprintf(stderr, "%d thread(s), %zu chunks, %.2fs, %.1f MB/s\n", threads, chunks.size(),
+          took.count(), total / 1e6 / took.count());
+  for (const auto &f : files) {
+    if (f.data)
+      munmap(const_cast<char *>(f.data), f.size);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,201 @@
+#include <android-base/file.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <sstream>
+
+#include "LoggerInternal.h"
+
+using android::base::WriteStringToFile;
+
+enum { SCONTEXT, TCONTEXT, TCLASS, PERM };
+
+// FNV-1a over all parts, with a separator so "ab","c" differs from "a","bc"
+static uint64_t hashParts(const std::string_view (&parts)[4]) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (const auto &p : parts) {
+    for (const char c : p) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 0x100000001b3ULL;
+    }
+    h ^= 0xff;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Value of " key=" up to the next space, empty if not found
+static std::string_view attribute(std::string_view line, std::string_view key) {
+  size_t idx = 0;
+  while ((idx = line.find(key, idx)) != std::string_view::npos) {
+    if (idx > 0 && line[idx - 1] == ' ' && idx + key.size() < line.size() &&
+        line[idx + key.size()] == '=') {
+      auto value = line.substr(idx + key.size() + 1);
+      return value.substr(0, value.find(' '));
+    }
+    idx += key.size();
+  }
+  return {};
+}
+
+AvcHotspots::AvcHotspots(int rateBucketMs) : kRateBucketMs(rateBucketMs) {
+  table.resize(256);
+}
+
+std::string_view AvcHotspots::part(const Entry &e, int i) const {
+  size_t off = e.key;
+  for (int j = 0; j < i; ++j)
+    off += e.len[j];
+  return std::string_view(pool).substr(off, e.len[i]);
+}
+
+AvcHotspots::Entry &AvcHotspots::find(uint64_t hash, const std::string_view (&parts)[4]) {
+  const size_t mask = table.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    auto &e = table[i];
+    if (e.count == 0)
+      return e;
+    if (e.hash != hash)
+      continue;
+    bool same = true;
+    for (int j = 0; j < 4 && same; ++j)
+      same = part(e, j) == parts[j];
+    if (same)
+      return e;
+  }
+}
+
+void AvcHotspots::grow() {
+  std::vector<Entry> old(table.size() * 2);
+  old.swap(table);
+  const size_t mask = table.size() - 1;
+  for (const auto &e : old) {
+    if (e.count == 0)
+      continue;
+    size_t i = e.hash & mask;
+    while (table[i].count != 0)
+      i = (i + 1) & mask;
+    table[i] = e;
+  }
+}
+
+bool AvcHotspots::add(std::string_view line, double timeMs) {
+  std::string_view parts[4];
+  bool added = false;
+  auto perms = line.substr(line.find('{') + 1);
+
+  perms = perms.substr(0, perms.find('}'));
+  parts[SCONTEXT] = attribute(line, "scontext");
+  parts[TCONTEXT] = attribute(line, "tcontext");
+  parts[TCLASS] = attribute(line, "tclass");
+  const size_t bucket =
+      kRateBucketMs > 0 ? std::min<size_t>(timeMs / kRateBucketMs, kRateBuckets - 1) : 0;
+
+  // One entry per permission, "{ read write }" counts both
+  while (!perms.empty()) {
+    const auto start = perms.find_first_not_of(' ');
+    if (start == std::string_view::npos)
+      break;
+    perms.remove_prefix(start);
+    parts[PERM] = perms.substr(0, perms.find(' '));
+    perms.remove_prefix(parts[PERM].size());
+
+    const auto hash = hashParts(parts);
+    auto *e = &find(hash, parts);
+    if (e->count == 0) {
+      // First occurrence, the only time anything is allocated
+      if ((used + 1) * 2 > table.size()) {
+        grow();
+        e = &find(hash, parts);
+      }
+      e->hash = hash;
+      e->key = pool.size();
+      for (int j = 0; j < 4; ++j) {
+        e->len[j] = std::min<size_t>(parts[j].size(), UINT16_MAX);
+        pool.append(parts[j].substr(0, e->len[j]));
+      }
+      e->firstMs = timeMs;
+      if (kRateBucketMs > 0) {
+        e->rate = rates.size();
+        rates.resize(rates.size() + kRateBuckets);
+      }
+      ++used;
+      added = true;
+    }
+    ++e->count;
+    e->lastMs = timeMs;
+    if (kRateBucketMs > 0)
+      ++rates[e->rate + bucket];
+  }
+  return added;
+}
+
+std::vector<const AvcHotspots::Entry *> AvcHotspots::sorted() const {
+  std::vector<const Entry *> ret;
+  for (const auto &e : table) {
+    if (e.count > 0)
+      ret.emplace_back(&e);
+  }
+  std::sort(ret.begin(), ret.end(), [](const auto *a, const auto *b) {
+    return a->count != b->count ? a->count > b->count : a->firstMs < b->firstMs;
+  });
+  return ret;
+}
+
+bool AvcHotspots::write(const std::filesystem::path &dir, size_t topN) const {
+  const auto entries = sorted();
+  std::ostringstream txt, csv;
+  uint64_t total = 0;
+  char line[512];
+  bool ret = true;
+
+  if (entries.empty())
+    return true;
+  for (const auto *e : entries)
+    total += e->count;
+  txt << total << " denials of " << entries.size() << " distinct (scontext, tcontext, tclass, perm)\n\n";
+  snprintf(line, sizeof(line), "%8s %9s %10s %10s  %s\n", "count", "per_sec", "first_ms",
+           "last_ms", "denial");
+  txt << line;
+  for (const auto *e : entries) {
+    const double span = (e->lastMs - e->firstMs) / 1000;
+    const auto scon = part(*e, SCONTEXT), tcon = part(*e, TCONTEXT);
+    const auto tclass = part(*e, TCLASS), perm = part(*e, PERM);
+    snprintf(line, sizeof(line), "%8" PRIu32 " %9.1f %10.0f %10.0f  %.*s %.*s:%.*s %.*s\n",
+             e->count, span > 0 ? e->count / span : 0, e->firstMs, e->lastMs,
+             static_cast<int>(scon.size()), scon.data(), static_cast<int>(tcon.size()),
+             tcon.data(), static_cast<int>(tclass.size()), tclass.data(),
+             static_cast<int>(perm.size()), perm.data());
+    txt << line;
+  }
+  ret &= WriteStringToFile(txt.str(), (dir / "avc_hotspots.txt").string());
+
+  if (kRateBucketMs > 0) {
+    // Denials per bucket of the top hotspots, one column each
+    const size_t kTop = std::min(topN, entries.size());
+    size_t last = 0;
+    csv << "time_ms";
+    for (size_t i = 0; i < kTop; ++i) {
+      const auto *e = entries[i];
+      csv << ',' << escapeCsv(std::string(part(*e, SCONTEXT)) + ' ' +
+                              std::string(part(*e, TCONTEXT)) + ':' +
+                              std::string(part(*e, TCLASS)) + ' ' + std::string(part(*e, PERM)));
+      for (size_t b = 0; b < kRateBuckets; ++b) {
+        if (rates[e->rate + b])
+          last = std::max(last, b);
+      }
+    }
+    csv << '\n';
+    for (size_t b = 0; b <= last; ++b) {
+      csv << b * kRateBucketMs;
+      for (size_t i = 0; i < kTop; ++i)
+        csv << ',' << rates[entries[i]->rate + b];
+      csv << '\n';
+    }
+    ret &= WriteStringToFile(csv.str(), (dir / "avc_rate.csv").string());
+  }
+  if (!ret)
+    PLOGE("Failed to write AVC hotspots to '%s'", dir.c_str());
+  return ret;
+}
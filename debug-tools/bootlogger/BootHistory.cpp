@@ -0,0 +1,231 @@
+#include <android-base/file.h>
+#include <android-base/parseint.h>
+#include <android-base/properties.h>
+#include <android-base/strings.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "LoggerInternal.h"
+
+using android::base::GetProperty;
+using android::base::ParseInt;
+using android::base::Split;
+using android::base::WriteStringToFile;
+
+namespace fs = std::filesystem;
+
+// (kind, name) -> milliseconds
+using BootSummary = std::map<std::pair<std::string, std::string>, double>;
+
+static constexpr char kHistoryPrefix[] = "boot-";
+static constexpr char kHistorySuffix[] = ".tsv";
+// Like diff(1), 1 means differences were found
+static constexpr int kExitRegressed = 1;
+static constexpr int kExitError = 2;
+
+static BootSummary summarize(const std::vector<TimelineEvent> &events) {
+  BootSummary summary;
+  for (const auto &ev : events) {
+    auto name = ev.name;
+    std::replace(name.begin(), name.end(), '\t', ' ');
+    switch (ev.type) {
+      case TimelineEvent::PHASE:
+        // When the phase was reached is what makes boot slower
+        summary[{"phase_at", name}] = ev.startMs;
+        if (ev.durationMs >= 0)
+          summary[{"phase", name}] = ev.durationMs;
+        break;
+      case TimelineEvent::SERVICE:
+        if (ev.durationMs >= 0)
+          summary[{"service", name}] += ev.durationMs;
+        break;
+      case TimelineEvent::COMMAND:
+        summary[{"took", name}] += ev.durationMs;
+        break;
+    }
+  }
+  return summary;
+}
+
+// Sorted oldest first, file names have increasing sequence numbers
+static std::vector<fs::path> listHistory(const fs::path &dir) {
+  std::vector<fs::path> files;
+  std::error_code ec;
+  for (const auto &ent : fs::directory_iterator(dir, ec)) {
+    const auto name = ent.path().filename().string();
+    if (name.find(kHistoryPrefix) == 0 && ent.path().extension() == kHistorySuffix)
+      files.emplace_back(ent.path());
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+static bool readSummary(const fs::path &file, BootSummary &out, std::string &build) {
+  std::ifstream ifs(file);
+  std::string line;
+  if (!ifs)
+    return false;
+  while (std::getline(ifs, line)) {
+    if (line.find("# build=") == 0) {
+      build = line.substr(8);
+      continue;
+    }
+    auto v = Split(line, "\t");
+    if (v.size() != 3)
+      continue;
+    out[{v[0], v[1]}] = std::strtod(v[2].c_str(), nullptr);
+  }
+  return true;
+}
+
+bool saveBootHistory(const fs::path &dir, const std::vector<TimelineEvent> &events,
+                     const int keep) {
+  std::error_code ec;
+  std::ostringstream ss;
+  unsigned seq = 0;
+  char name[32];
+
+  fs::create_directories(dir, ec);
+  if (ec) {
+    ALOGE("Failed to create '%s': %s", dir.c_str(), ec.message().c_str());
+    return false;
+  }
+  auto files = listHistory(dir);
+  if (!files.empty()) {
+    auto last = files.back().stem().string().substr(strlen(kHistoryPrefix));
+    // Zero padded, ParseInt() would take it as octal
+    seq = std::strtoul(last.c_str(), nullptr, 10) + 1;
+  }
+  ss << "# build=" << GetProperty("ro.build.fingerprint", "unknown") << '\n';
+  ss.precision(3);
+  ss << std::fixed;
+  for (const auto &e : summarize(events))
+    ss << e.first.first << '\t' << e.first.second << '\t' << e.second << '\n';
+  snprintf(name, sizeof(name), "%s%06u%s", kHistoryPrefix, seq, kHistorySuffix);
+  if (!WriteStringToFile(ss.str(), (dir / name).string())) {
+    PLOGE("Failed to write '%s'", name);
+    return false;
+  }
+  files.emplace_back(dir / name);
+  // Keep last [keep] boots only
+  for (size_t i = 0; i + keep < files.size(); ++i)
+    fs::remove(files[i], ec);
+  ALOGI("Saved boot history '%s'", name);
+  return true;
+}
+
+static double median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  auto n = v.size();
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// Median absolute deviation, scaled to estimate standard deviation
+static double robustStdDev(const std::vector<double> &v, const double med) {
+  std::vector<double> dev;
+  for (const auto x : v)
+    dev.emplace_back(std::fabs(x - med));
+  return 1.4826 * median(dev);
+}
+
+struct Regression {
+  std::string kind, name;
+  double baseline, current, noise;
+};
+
+static void compareUsage(const char *argv0) {
+  fprintf(stderr, "Usage: %s compare [log directory] [-t threshold ms] [-r recent boots]\n", argv0);
+  fprintf(stderr, "  Compares the median of the most recent boots against the previous ones\n");
+  fprintf(stderr, "  Returns 1 if a phase, service or command regressed beyond the threshold,\n");
+  fprintf(stderr, "  2 on error\n");
+}
+
+int compareMain(int argc, const char **argv) {
+  int threshold = 300, recent = 1;
+  const char *argv0 = argv[0];
+  std::vector<BootSummary> boots;
+  std::vector<std::string> builds;
+  std::vector<Regression> regressions;
+  std::map<std::pair<std::string, std::string>, std::vector<double>> baseline, current;
+  int compared = 0;
+
+  // Skip program name and subcommand
+  argc -= 2;
+  argv += 2;
+  if (argc < 1) {
+    compareUsage(argv0);
+    return kExitError;
+  }
+  const fs::path dir = fs::path(argv[0]) / kHistoryDir;
+  for (int i = 1; i < argc; i += 2) {
+    bool ok = i + 1 < argc;
+    if (ok && strcmp(argv[i], "-t") == 0)
+      ok = ParseInt(argv[i + 1], &threshold, 0);
+    else if (ok && strcmp(argv[i], "-r") == 0)
+      ok = ParseInt(argv[i + 1], &recent, 1);
+    else
+      ok = false;
+    if (!ok) {
+      compareUsage(argv0);
+      return kExitError;
+    }
+  }
+
+  for (const auto &file : listHistory(dir)) {
+    BootSummary s;
+    std::string build;
+    if (readSummary(file, s, build)) {
+      boots.emplace_back(std::move(s));
+      builds.emplace_back(build);
+    }
+  }
+  if (boots.size() <= static_cast<size_t>(recent)) {
+    fprintf(stderr, "Need more than %d boot(s) in '%s', have %zu\n", recent, dir.c_str(),
+            boots.size());
+    return kExitError;
+  }
+  const size_t split = boots.size() - recent;
+  for (size_t i = 0; i < boots.size(); ++i) {
+    for (const auto &e : boots[i])
+      (i < split ? baseline : current)[e.first].emplace_back(e.second);
+  }
+
+  printf("Comparing %d recent boot(s) against %zu previous boot(s), threshold %dms\n",
+         recent, split, threshold);
+  printf("Baseline build: %s\n", builds[split - 1].c_str());
+  printf("Current build:  %s\n", builds.back().c_str());
+  for (const auto &c : current) {
+    auto it = baseline.find(c.first);
+    if (it == baseline.end())
+      continue;
+    ++compared;
+    const double base = median(it->second);
+    const double cur = median(c.second);
+    // Noise of both sides, a change within 3 sigma is not reported
+    const double noise = 3 * std::max(robustStdDev(it->second, base),
+                                      robustStdDev(c.second, cur));
+    if (cur - base > threshold && cur - base > noise)
+      regressions.push_back({c.first.first, c.first.second, base, cur, noise});
+  }
+  std::sort(regressions.begin(), regressions.end(), [](const auto &a, const auto &b) {
+    return a.current - a.baseline > b.current - b.baseline;
+  });
+
+  if (!regressions.empty()) {
+    printf("\n%-9s %-48s %11s %11s %10s %9s\n", "kind", "name", "baseline", "current",
+           "delta", "noise");
+    for (const auto &r : regressions) {
+      printf("%-9s %-48.48s %11.1f %11.1f %+10.1f %9.1f\n", r.kind.c_str(), r.name.c_str(),
+             r.baseline, r.current, r.current - r.baseline, r.noise);
+    }
+  }
+  printf("\n%zu regression(s) in %d compared metrics\n", regressions.size(), compared);
+  return regressions.empty() ? EXIT_SUCCESS : kExitRegressed;
+}
@@ -0,0 +1,251 @@
+#include <android-base/file.h>
+
+#include <time.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include "LoggerInternal.h"
+
+using android::base::WriteStringToFile;
+
+double getMonotonicMs() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+double getLineTimeMs(const LogLine &line) {
+  // printk and logcat -v monotonic timestamps are seconds since boot, same
+  // base as CLOCK_MONOTONIC. The logcat backlog is read all at once, so the
+  // time of capture would put all of it at the same point.
+  if ((line.kernel && !line.timestamp.empty()) || isMonotonicTimestamp(line.timestamp))
+    return std::strtod(std::string(line.timestamp).c_str(), nullptr) * 1000.0;
+  // Wall clock logcat timestamps, use the time of capture instead
+  return getMonotonicMs();
+}
+
+// Returns text between the first pair of single quotes
+static std::string_view quoted(std::string_view sv) {
+  auto begin = sv.find('\'');
+  if (begin == std::string_view::npos)
+    return {};
+  auto end = sv.find('\'', begin + 1);
+  if (end == std::string_view::npos)
+    return {};
+  return sv.substr(begin + 1, end - begin - 1);
+}
+
+// Parses "took 123ms" or "took to complete: 123ms" and returns the milliseconds
+static bool parseTook(std::string_view sv, double &ms, std::string_view &what) {
+  auto idx = sv.find(" took ");
+  if (idx == std::string_view::npos)
+    return false;
+  what = sv.substr(0, idx);
+  sv.remove_prefix(idx + 6);
+  if (sv.substr(0, 12) == "to complete:")
+    sv.remove_prefix(12);
+  while (!sv.empty() && sv.front() == ' ')
+    sv.remove_prefix(1);
+  std::string num(sv.substr(0, sv.find_first_not_of("0123456789.")));
+  ms = std::strtod(num.c_str(), nullptr);
+  return !num.empty() && sv.substr(num.size(), 2) == "ms";
+}
+
+void BootTimeline::onInitLine(const LogLine &line, double time) {
+  constexpr std::string_view kAction = "processing action (";
+  constexpr std::string_view kStarting = "starting service '";
+  constexpr std::string_view kService = "Service '";
+  const auto msg = line.message;
+  std::string_view what;
+  double took;
+
+  if (msg.substr(0, kAction.size()) == kAction) {
+    auto trigger = msg.substr(kAction.size());
+    trigger = trigger.substr(0, trigger.find(')'));
+    addPhase(std::string(trigger), time);
+  } else if (msg.substr(0, kStarting.size()) == kStarting) {
+    auto name = std::string(quoted(msg));
+    events.push_back({TimelineEvent::SERVICE, name, time, -1, ""});
+    runningServices[name] = events.size() - 1;
+  } else if (msg.substr(0, kService.size()) == kService &&
+             (msg.find(" exited with status ") != std::string_view::npos ||
+              msg.find(" killed by signal ") != std::string_view::npos)) {
+    auto it = runningServices.find(std::string(quoted(msg)));
+    if (it != runningServices.end()) {
+      auto &ev = events[it->second];
+      ev.durationMs = time - ev.startMs;
+      // "Service 'x' (pid 1) exited with status 0 ..."
+      const auto paren = msg.find(") ");
+      if (paren != std::string_view::npos)
+        ev.detail = msg.substr(paren + 2);
+      runningServices.erase(it);
+    }
+  } else if (parseTook(msg, took, what)) {
+    // "Command 'write /x y' action=post-fs-data (/init.rc:1) took 12ms and succeeded"
+    std::string name(quoted(what));
+    std::string detail;
+    auto action = what.find("action=");
+    if (name.empty())
+      name = what;
+    if (action != std::string_view::npos)
+      detail = what.substr(action);
+    events.push_back({TimelineEvent::COMMAND, name, time - took, took, detail});
+  }
+}
+
+void BootTimeline::onSystemServerLine(const LogLine &line, double time) {
+  constexpr std::string_view kPhase = "Starting phase ";
+  const auto msg = line.message;
+  std::string_view what;
+  double took;
+
+  if (line.tag == "SystemServiceManager" && msg.substr(0, kPhase.size()) == kPhase) {
+    addPhase("system_server phase " + std::string(msg.substr(kPhase.size())), time);
+  } else if (line.tag == "SystemServer" && msg.find("Entered the Android system server") == 0) {
+    addPhase("system_server start", time);
+  } else if (line.tag.substr(0, 18) == "SystemServerTiming" && parseTook(msg, took, what)) {
+    events.push_back({TimelineEvent::COMMAND, std::string(what), time - took, took,
+                      std::string(line.tag)});
+  }
+}
+
+void BootTimeline::onLine(std::string_view str) {
+  LogLine line;
+
+  parseLogLine(str, line);
+  // Cheap check before taking the lock, most lines are not interesting
+  if (line.tag == "init") {
+    const std::lock_guard<std::mutex> _(lock);
+    onInitLine(line, getLineTimeMs(line));
+  } else if (!line.kernel && line.tag.substr(0, 10) == "SystemServ") {
+    const std::lock_guard<std::mutex> _(lock);
+    onSystemServerLine(line, getLineTimeMs(line));
+  }
+}
+
+void BootTimeline::addPhase(const std::string &name, double time) {
+  // Actions may run more than once, only the first one marks a phase
+  for (const auto &ev : events) {
+    if (ev.type == TimelineEvent::PHASE && ev.name == name)
+      return;
+  }
+  events.push_back({TimelineEvent::PHASE, name, time, -1, ""});
+}
+
+void BootTimeline::markPhase(const std::string &name) {
+  const std::lock_guard<std::mutex> _(lock);
+  addPhase(name, getMonotonicMs());
+}
+
+std::vector<TimelineEvent> BootTimeline::getEvents() {
+  const std::lock_guard<std::mutex> _(lock);
+  auto ret = events;
+  std::stable_sort(ret.begin(), ret.end(), [](const auto &a, const auto &b) {
+    return a.startMs < b.startMs;
+  });
+  // A phase lasts until the next one
+  TimelineEvent *last = nullptr;
+  for (auto &ev : ret) {
+    if (ev.type != TimelineEvent::PHASE)
+      continue;
+    if (last)
+      last->durationMs = ev.startMs - last->startMs;
+    last = &ev;
+  }
+  return ret;
+}
+
+static const char *typeToString(TimelineEvent::Type type) {
+  switch (type) {
+    case TimelineEvent::PHASE:
+      return "phase";
+    case TimelineEvent::SERVICE:
+      return "service";
+    case TimelineEvent::COMMAND:
+      return "took";
+  }
+  return "";
+}
+
+std::string escapeJson(const std::string &str) {
+  std::string ret;
+  for (const char c : str) {
+    if (c == '"' || c == '\\')
+      ret += '\\';
+    if (static_cast<unsigned char>(c) < 0x20)
+      continue;
+    ret += c;
+  }
+  return ret;
+}
+
+std::string escapeCsv(const std::string &str) {
+  if (str.find_first_of(",\"") == std::string::npos)
+    return str;
+  std::string ret = "\"";
+  for (const char c : str) {
+    if (c == '"')
+      ret += '"';
+    ret += c;
+  }
+  return ret + '"';
+}
+
+bool BootTimeline::write(const std::filesystem::path &dir) {
+  const auto kEvents = getEvents();
+  std::ostringstream csv, json, trace;
+  bool ret = true;
+
+  csv.precision(3);
+  json.precision(3);
+  trace.precision(0);
+  csv << std::fixed << "type,name,start_ms,duration_ms,detail\n";
+  json << std::fixed << "{\"events\":[";
+  // Chrome JSON trace format, can be opened by ui.perfetto.dev
+  trace << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  trace << R"({"name":"process_name","ph":"M","pid":1,"args":{"name":"boot"}})";
+  for (size_t i = 0; i < kEvents.size(); ++i) {
+    const auto &ev = kEvents[i];
+    const auto type = typeToString(ev.type);
+    csv << type << ',' << escapeCsv(ev.name) << ',' << ev.startMs << ',';
+    if (ev.durationMs >= 0)
+      csv << ev.durationMs;
+    csv << ',' << escapeCsv(ev.detail) << '\n';
+
+    json << (i ? "," : "") << "{\"type\":\"" << type << "\",\"name\":\"" << escapeJson(ev.name)
+         << "\",\"start_ms\":" << ev.startMs;
+    if (ev.durationMs >= 0)
+      json << ",\"duration_ms\":" << ev.durationMs;
+    if (!ev.detail.empty())
+      json << ",\"detail\":\"" << escapeJson(ev.detail) << '"';
+    json << '}';
+
+    // One track (tid) per event type
+    trace << ",{\"name\":\"" << escapeJson(ev.name) << "\",\"cat\":\"" << type
+          << "\",\"pid\":1,\"tid\":" << ev.type + 1 << ",\"ts\":" << ev.startMs * 1000;
+    if (ev.durationMs >= 0)
+      trace << ",\"ph\":\"X\",\"dur\":" << ev.durationMs * 1000;
+    else
+      trace << R"(,"ph":"i","s":"t")";
+    if (!ev.detail.empty())
+      trace << ",\"args\":{\"detail\":\"" << escapeJson(ev.detail) << "\"}";
+    trace << '}';
+  }
+  for (int t = TimelineEvent::PHASE; t <= TimelineEvent::COMMAND; ++t) {
+    trace << ",{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t + 1
+          << ",\"args\":{\"name\":\"" << typeToString(static_cast<TimelineEvent::Type>(t))
+          << "\"}}";
+  }
+  json << "]}\n";
+  trace << "]}\n";
+
+  ret &= WriteStringToFile(csv.str(), (dir / "timeline.csv").string());
+  ret &= WriteStringToFile(json.str(), (dir / "timeline.json").string());
+  ret &= WriteStringToFile(trace.str(), (dir / "boottrace.json").string());
+  if (!ret)
+    PLOGE("Failed to write timeline to '%s'", dir.c_str());
+  return ret;
+}
@@ -0,0 +1,401 @@
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "LoggerInternal.h"
+
+using android::base::ParseInt;
+using android::base::Split;
+
+// Records are 8 byte aligned, and never wrap around the end of the ring
+struct LiveRecordHeader {
+  uint32_t len;  // Of the line, including the new line
+  uint8_t source;
+  uint8_t padding[3];
+};
+static constexpr uint8_t kWrapSource = 0xff;
+// Records copied out of the ring and sent at once, bounds the time the
+// ring is locked by a subscriber
+static constexpr int kMaxIov = 64;
+// Limit of the filter line a subscriber sends first
+static constexpr size_t kMaxFilterLen = 1024;
+
+static constexpr size_t alignRecord(size_t len) {
+  return (sizeof(LiveRecordHeader) + len + 7) & ~static_cast<size_t>(7);
+}
+
+static bool makeAddress(const std::string &name, sockaddr_un &addr, socklen_t &len) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  // Abstract namespace, there is no file to create or clean up
+  if (name.size() + 1 > sizeof(addr.sun_path))
+    return false;
+  memcpy(addr.sun_path + 1, name.data(), name.size());
+  len = offsetof(sockaddr_un, sun_path) + 1 + name.size();
+  return true;
+}
+
+LivePublisher::LivePublisher(size_t ringSize) : ring((ringSize + 7) & ~static_cast<size_t>(7)) {}
+
+int LivePublisher::addSource(const std::string &name) {
+  sources.emplace_back(name);
+  return sources.size() - 1;
+}
+
+bool LivePublisher::start(const std::string &name, std::atomic_bool *run) {
+  sockaddr_un addr{};
+  socklen_t len;
+
+  if (!makeAddress(name, addr, len)) {
+    ALOGE("%s: Invalid socket name '%s'", __func__, name.c_str());
+    return false;
+  }
+  listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr *>(&addr), len) != 0 ||
+      listen(listenFd, 8) != 0) {
+    PLOGE("Failed to listen on '@%s'", name.c_str());
+    return false;
+  }
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeFd < 0) {
+    PLOGE("eventfd");
+    return false;
+  }
+  ALOGI("%s: Publishing on '@%s', %zu bytes ring", __func__, name.c_str(), ring.size());
+  thread = std::thread([this, run] { serve(run); });
+  return true;
+}
+
+void LivePublisher::publish(int source, std::string_view line) {
+  const size_t len = std::min(line.size() + 1, ring.size() / 4);
+  const size_t size = alignRecord(len);
+  const size_t cap = ring.size();
+
+  {
+    const std::lock_guard<std::mutex> _(lock);
+    size_t pos = head % cap;
+    if (cap - pos < size) {
+      // Does not fit before the end, skip to the start
+      auto *wrap = reinterpret_cast<LiveRecordHeader *>(&ring[pos]);
+      const size_t skip = cap - pos;
+      makeRoom(skip);
+      wrap->len = skip - sizeof(LiveRecordHeader);
+      wrap->source = kWrapSource;
+      head += skip;
+      pos = 0;
+    }
+    makeRoom(size);
+    auto *hdr = reinterpret_cast<LiveRecordHeader *>(&ring[pos]);
+    hdr->len = len;
+    hdr->source = source;
+    memcpy(&ring[pos + sizeof(*hdr)], line.data(), len - 1);
+    ring[pos + sizeof(*hdr) + len - 1] = '\n';
+    head += size;
+  }
+  // One wakeup per batch, the server clears the flag when it runs
+  if (!wakePending.exchange(true)) {
+    const uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+      PLOGE("Failed to wake the publisher");
+  }
+}
+
+// Drops the oldest records until [size] more bytes fit. Needs lock held.
+void LivePublisher::makeRoom(size_t size) {
+  const size_t cap = ring.size();
+  while (head + size - tail > cap) {
+    const auto *hdr = reinterpret_cast<const LiveRecordHeader *>(&ring[tail % cap]);
+    if (hdr->source != kWrapSource)
+      ++tailSeq;
+    tail += alignRecord(hdr->len);
+  }
+}
+
+bool LivePublisher::Subscriber::parseFilter(const std::string &spec,
+                                            const std::vector<std::string> &sources) {
+  for (const auto &tok : Split(spec, " ")) {
+    if (tok.empty())
+      continue;
+    const auto idx = tok.find('=');
+    const auto key = tok.substr(0, idx);
+    const auto val = idx == std::string::npos ? "" : tok.substr(idx + 1);
+    if (key == "source") {
+      auto it = std::find(sources.begin(), sources.end(), val);
+      if (it == sources.end())
+        return false;
+      source = it - sources.begin();
+    } else if (key == "tag") {
+      tags.emplace_back(val);
+    } else if (key == "pid") {
+      if (!ParseInt(val, &pid, 0))
+        return false;
+    } else if (key == "prio") {
+      if (val.size() != 1 || !strchr("VDIWEF", val[0]))
+        return false;
+      minSeverity = getLogSeverity(val[0]);
+    } else if (key == "text") {
+      text = val;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool LivePublisher::Subscriber::matches(int src, std::string_view line) const {
+  LogLine parsed;
+
+  if (source >= 0 && src != source)
+    return false;
+  if (tags.empty() && pid < 0 && minSeverity == 0 && text.empty())
+    return true;
+  parseLogLine(line, parsed);
+  if (pid >= 0 && parsed.pid != pid)
+    return false;
+  if (getLogSeverity(parsed) < minSeverity)
+    return false;
+  if (!text.empty() && line.find(text) == std::string_view::npos)
+    return false;
+  return tags.empty() || std::find(tags.begin(), tags.end(), parsed.tag) != tags.end();
+}
+
+// Reads the filter line. Returns false if the subscriber is gone or invalid.
+bool LivePublisher::readFilter(Subscriber &sub) {
+  char buf[256];
+  ssize_t len;
+
+  while ((len = read(sub.fd, buf, sizeof(buf))) > 0) {
+    sub.pending.append(buf, len);
+    const auto nl = sub.pending.find('\n');
+    if (nl != std::string::npos) {
+      if (!sub.parseFilter(sub.pending.substr(0, nl), sources)) {
+        const std::string msg = LOG_TAG ": invalid filter\n";
+        (void)!write(sub.fd, msg.data(), msg.size());
+        return false;
+      }
+      sub.pending.clear();
+      sub.streaming = true;
+      // New subscribers start at the oldest line in the ring
+      const std::lock_guard<std::mutex> _(lock);
+      sub.pos = tail;
+      sub.seq = tailSeq;
+      return true;
+    }
+    if (sub.pending.size() > kMaxFilterLen)
+      return false;
+  }
+  return len < 0 && errno == EAGAIN;
+}
+
+// Sends what is pending and new lines. Returns false if the subscriber is gone.
+bool LivePublisher::send(Subscriber &sub) {
+  struct iovec iov[kMaxIov + 1];
+  const size_t cap = ring.size();
+
+  while (true) {
+    int n = 0;
+    size_t total = 0, sent;
+    uint64_t pos, seq;
+    bool caughtUp;
+
+    sub.batch.clear();
+    {
+      // Only copies a bounded number of records out. Filtering and sending
+      // happen without the lock, so capture never waits on a subscriber.
+      const std::lock_guard<std::mutex> _(lock);
+      if (sub.seq < tailSeq) {
+        // Lapped by capture, only this subscriber loses lines
+        sub.dropped += tailSeq - sub.seq;
+        sub.pending += LOG_TAG ": dropped " + std::to_string(tailSeq - sub.seq) + " lines\n";
+        sub.pos = tail;
+        sub.seq = tailSeq;
+      }
+      pos = sub.pos;
+      seq = sub.seq;
+      for (int records = 0; pos < head && records < kMaxIov;) {
+        const auto *hdr = reinterpret_cast<const LiveRecordHeader *>(&ring[pos % cap]);
+        pos += alignRecord(hdr->len);
+        if (hdr->source == kWrapSource)
+          continue;
+        ++seq;
+        ++records;
+        sub.batch.append(reinterpret_cast<const char *>(hdr), sizeof(*hdr) + hdr->len);
+      }
+      caughtUp = pos >= head;
+    }
+
+    if (!sub.pending.empty()) {
+      iov[n++] = {sub.pending.data(), sub.pending.size()};
+      total += sub.pending.size();
+    }
+    for (size_t off = 0; off < sub.batch.size();) {
+      LiveRecordHeader hdr;
+      memcpy(&hdr, &sub.batch[off], sizeof(hdr));
+      char *data = &sub.batch[off + sizeof(hdr)];
+      off += sizeof(hdr) + hdr.len;
+      if (!sub.matches(hdr.source, std::string_view(data, hdr.len - 1)))
+        continue;
+      iov[n++] = {data, hdr.len};
+      total += hdr.len;
+    }
+    if (n == 0) {
+      sub.pos = pos;
+      sub.seq = seq;
+      if (caughtUp)
+        return true;
+      continue;
+    }
+    const ssize_t ret = writev(sub.fd, iov, n);
+    if (ret < 0) {
+      if (errno != EAGAIN)
+        return false;
+      // Copied again next time, or reported as dropped if lapped meanwhile
+      sub.blocked = true;
+      return true;
+    }
+    sent = ret;
+    if (sent < total) {
+      // Keep the unsent tail, the batch is reused
+      std::string rest;
+      size_t off = 0;
+      for (int i = 0; i < n; ++i) {
+        const size_t len = iov[i].iov_len;
+        if (off + len > sent)
+          rest.append(static_cast<char *>(iov[i].iov_base) + std::max(off, sent) - off,
+                      off + len - std::max(off, sent));
+        off += len;
+      }
+      sub.pending = std::move(rest);
+      sub.blocked = true;
+    } else {
+      sub.pending.clear();
+    }
+    sub.pos = pos;
+    sub.seq = seq;
+    sub.sent += sent;
+    if (sub.blocked || caughtUp)
+      return true;
+  }
+}
+
+void LivePublisher::serve(std::atomic_bool *run) {
+  std::vector<pollfd> fds;
+
+  while (*run) {
+    fds.clear();
+    fds.push_back({listenFd, POLLIN, 0});
+    fds.push_back({wakeFd, POLLIN, 0});
+    for (const auto &sub : subscribers)
+      fds.push_back({sub.fd, static_cast<short>(POLLIN | (sub.blocked ? POLLOUT : 0)), 0});
+    // Timeout to notice stop requests
+    if (poll(fds.data(), fds.size(), 200) < 0 && errno != EINTR) {
+      PLOGE("poll");
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      uint64_t value;
+      wakePending = false;
+      (void)!read(wakeFd, &value, sizeof(value));
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd;
+      while ((fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        Subscriber sub;
+        sub.fd = fd;
+        subscribers.emplace_back(std::move(sub));
+        ALOGI("%s: Subscriber %d connected", __func__, fd);
+      }
+    }
+    for (size_t i = 0; i < subscribers.size(); ++i) {
+      auto &sub = subscribers[i];
+      bool ok = true;
+      // Indexes of fds are off by two, new subscribers have none yet
+      const short revents = i + 2 < fds.size() ? fds[i + 2].revents : 0;
+      if (revents & POLLOUT)
+        sub.blocked = false;
+      if (!sub.streaming)
+        ok = readFilter(sub);
+      else if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        // Subscribers send nothing after the filter, this is a hang up
+        char c;
+        ok = recv(sub.fd, &c, 1, MSG_DONTWAIT) < 0 && errno == EAGAIN;
+      }
+      if (ok && sub.streaming && !sub.blocked)
+        ok = send(sub);
+      if (!ok)
+        sub.closed = true;
+    }
+    closeSubscribers(false);
+  }
+  closeSubscribers(true);
+}
+
+void LivePublisher::closeSubscribers(bool all) {
+  for (auto it = subscribers.begin(); it != subscribers.end();) {
+    if (all || it->closed) {
+      ALOGI("Subscriber %d left, %" PRIu64 " bytes sent, %" PRIu64 " lines dropped", it->fd,
+            it->sent, it->dropped);
+      close(it->fd);
+      it = subscribers.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+LivePublisher::~LivePublisher() {
+  if (thread.joinable())
+    thread.join();
+  for (const int fd : {listenFd, wakeFd}) {
+    if (fd >= 0)
+      close(fd);
+  }
+}
+
+int followMain(int argc, const char **argv) {
+  sockaddr_un addr{};
+  socklen_t len;
+  std::string filter;
+  char buf[4096];
+  ssize_t n;
+
+  for (int i = 2; i < argc; ++i)
+    filter += std::string(i > 2 ? " " : "") + argv[i];
+  filter += '\n';
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  bool connected = false;
+  // Boot logger first, it hands over to the system one after boot
+  for (const char *name : {kLiveSocketName, kLiveSystemSocketName}) {
+    if (fd >= 0 && !connected && makeAddress(name, addr, len))
+      connected = connect(fd, reinterpret_cast<sockaddr *>(&addr), len) == 0;
+  }
+  if (!connected) {
+    fprintf(stderr, "Cannot connect to bootlogger: %s\n", strerror(errno));
+    fprintf(stderr, "Usage: %s follow [source=dmesg|logcat] [tag=T]... [pid=N] [prio=V|D|I|W|E|F] "
+            "[text=S]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (write(fd, filter.data(), filter.size()) < 0) {
+    perror("write");
+    return EXIT_FAILURE;
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    if (fwrite(buf, 1, n, stdout) != static_cast<size_t>(n))
+      break;
+    fflush(stdout);
+  }
+  close(fd);
+  return EXIT_SUCCESS;
+}
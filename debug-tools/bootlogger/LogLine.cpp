@@ -0,0 +1,150 @@
+#include <cctype>
+#include <cstring>
+#include <string_view>
+
+#include "LoggerInternal.h"
+
+static inline void skipSpaces(std::string_view &sv) {
+  while (!sv.empty() && std::isspace(static_cast<unsigned char>(sv.front())))
+    sv.remove_prefix(1);
+}
+
+static inline std::string_view nextToken(std::string_view &sv) {
+  skipSpaces(sv);
+  auto end = sv.find_first_of(" \t");
+  auto token = sv.substr(0, end);
+  sv.remove_prefix(token.size());
+  return token;
+}
+
+static bool toInt(std::string_view sv, int &out) {
+  int value = 0;
+  if (sv.empty())
+    return false;
+  for (const char c : sv) {
+    if (c < '0' || c > '9')
+      return false;
+    value = value * 10 + (c - '0');
+  }
+  out = value;
+  return true;
+}
+
+// "<6>[    1.234567]  [0:      swapper/0:    1] init: ..."
+static bool parseKmsgLine(std::string_view line, LogLine &out) {
+  std::string_view sv = line;
+
+  if (sv.size() >= 3 && sv[0] == '<' && sv[2] == '>') {
+    out.priority = sv[1];
+    sv.remove_prefix(3);
+  }
+  if (sv.empty() || sv.front() != '[')
+    return false;
+  auto end = sv.find(']');
+  if (end == std::string_view::npos)
+    return false;
+  out.timestamp = sv.substr(1, end - 1);
+  skipSpaces(out.timestamp);
+  sv.remove_prefix(end + 1);
+  skipSpaces(sv);
+  // Samsung kernels append [cpu: comm: pid] after the timestamp
+  if (!sv.empty() && sv.front() == '[') {
+    end = sv.find(']');
+    if (end != std::string_view::npos) {
+      auto pid = sv.substr(0, end);
+      pid.remove_prefix(pid.find_last_of(':') + 1);
+      skipSpaces(pid);
+      toInt(pid, out.pid);
+      sv.remove_prefix(end + 1);
+      skipSpaces(sv);
+    }
+  }
+  out.body = sv;
+  out.message = sv;
+  // Driver prefix, like "init: " or "binder: "
+  auto tag = sv.substr(0, sv.find(' '));
+  if (tag.size() > 1 && tag.back() == ':') {
+    out.message.remove_prefix(tag.size());
+    skipSpaces(out.message);
+    tag.remove_suffix(1);
+    out.tag = tag;
+  }
+  out.kernel = true;
+  return true;
+}
+
+// "10-18 12:34:56.789  1234  1235 I Tag     : message", or with -v monotonic
+// "   12.345  1234  1235 I Tag     : message"
+static bool parseLogcatLine(std::string_view line, LogLine &out) {
+  std::string_view sv = line;
+  auto date = nextToken(sv);
+
+  if (isMonotonicTimestamp(date)) {
+    out.timestamp = date;
+  } else {
+    auto time = nextToken(sv);
+    if (date.size() != 5 || date[2] != '-' || time.size() < 8 || time[2] != ':')
+      return false;
+    out.timestamp = line.substr(0, time.data() + time.size() - line.data());
+  }
+  if (!toInt(nextToken(sv), out.pid) || !toInt(nextToken(sv), out.tid))
+    return false;
+  auto prio = nextToken(sv);
+  if (prio.size() != 1)
+    return false;
+  out.priority = prio.front();
+  skipSpaces(sv);
+  auto sep = sv.find(": ");
+  if (sep == std::string_view::npos)
+    sep = sv.find(':');
+  if (sep == std::string_view::npos)
+    return false;
+  out.tag = sv.substr(0, sep);
+  while (!out.tag.empty() && out.tag.back() == ' ')
+    out.tag.remove_suffix(1);
+  out.message = sv.substr(std::min(sep + 2, sv.size()));
+  // Keep pid/tid in body, as those tell apart repeats from different threads
+  out.body = line.substr(out.timestamp.data() + out.timestamp.size() - line.data());
+  skipSpaces(out.body);
+  out.kernel = false;
+  return true;
+}
+
+bool isMonotonicTimestamp(std::string_view ts) {
+  const auto dot = ts.find('.');
+  int secs, frac;
+  return dot != std::string_view::npos && toInt(ts.substr(0, dot), secs) &&
+         toInt(ts.substr(dot + 1), frac);
+}
+
+bool parseLogLine(std::string_view line, LogLine &out) {
+  out = LogLine{};
+  out.body = line;
+  if (parseKmsgLine(line, out))
+    return true;
+  out = LogLine{};
+  out.body = line;
+  if (parseLogcatLine(line, out))
+    return true;
+  out = LogLine{};
+  out.body = line;
+  out.message = line;
+  return false;
+}
+
+int getLogSeverity(const LogLine &line) {
+  static constexpr char kLogcat[] = "VDIWEF";
+  // KERN_EMERG ... KERN_DEBUG
+  static constexpr int kKernel[] = {7, 7, 7, 6, 5, 4, 4, 3};
+
+  if (line.kernel)
+    return line.priority >= '0' && line.priority <= '7' ? kKernel[line.priority - '0'] : 4;
+  const char *p = line.priority ? strchr(kLogcat, line.priority) : nullptr;
+  return p ? static_cast<int>(p - kLogcat) + 2 : 4;
+}
+
+int getLogSeverity(char priority) {
+  LogLine line;
+  line.priority = priority;
+  return getLogSeverity(line);
+}
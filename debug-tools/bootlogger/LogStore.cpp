@@ -0,0 +1,437 @@
+#include <android-base/parseint.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "LoggerInternal.h"
+
+using android::base::ParseInt;
+
+namespace fs = std::filesystem;
+
+// File layout:
+//   "BLSTORE2"
+//   { LogBlockHeader, bloom filter, zlib compressed lines joined by '\n' } ...
+//   LogBlockIndex[count], IndexFooter   (Written on close)
+// If the footer is missing, like after a crash, readers walk the block headers.
+static constexpr char kFileMagic[8] = {'B', 'L', 'S', 'T', 'O', 'R', 'E', '2'};
+static constexpr uint32_t kBlockMagic = 0x4b4c4253;  // "SBLK"
+static constexpr uint32_t kIndexMagic = 0x58444e49;  // "INDX"
+// Uncompressed size of a block, and the age at which a partial block is written
+static constexpr size_t kBlockSize = 64 * 1024;
+static constexpr auto kBlockMaxAge = std::chrono::seconds(2);
+// Bloom filter bits per distinct key and hashes, about 1% false positives
+static constexpr uint32_t kBloomBitsPerKey = 10;
+static constexpr uint32_t kBloomHashes = 7;
+
+// Size of a block in the file, with its header
+static uint64_t blockSize(const LogBlockHeader &h) {
+  return sizeof(LogBlockHeader) + h.bloomBits / 8 + h.compSize;
+}
+
+struct IndexFooter {
+  uint64_t offset;  // Of the first LogBlockIndex
+  uint32_t count;
+  uint32_t magic;
+};
+
+// FNV-1a, stable across builds unlike std::hash
+static uint64_t hashKey(char kind, std::string_view key) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ static_cast<unsigned char>(kind);
+  for (const char c : key) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Bloom filter of [bits] bits with [hashes] hashes, derived from one
+static void bloomAdd(std::vector<uint64_t> &bloom, uint32_t bits, uint32_t hashes, uint64_t h) {
+  const uint64_t h2 = (h >> 32) | 1;
+  for (uint32_t i = 0; i < hashes; ++i, h += h2)
+    bloom[(h % bits) / 64] |= 1ULL << (h % bits % 64);
+}
+
+static bool bloomMayContain(const std::vector<uint64_t> &bloom, uint32_t bits, uint32_t hashes,
+                            uint64_t h) {
+  const uint64_t h2 = (h >> 32) | 1;
+  for (uint32_t i = 0; i < hashes; ++i, h += h2) {
+    if (!(bloom[(h % bits) / 64] & (1ULL << (h % bits % 64))))
+      return false;
+  }
+  return true;
+}
+
+int64_t parseLogTimeMs(std::string_view ts) {
+  // Days before each month, year is unknown so no leap days
+  static constexpr int kDays[] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  int mon, day, h, m;
+  double s;
+  const std::string str(ts);
+
+  // Logcat "MM-DD HH:MM:SS.mmm"
+  if (sscanf(str.c_str(), "%d-%d %d:%d:%lf", &mon, &day, &h, &m, &s) == 5 && mon >= 1 &&
+      mon <= 12) {
+    return (((kDays[mon - 1] + day - 1) * 24LL + h) * 60 + m) * 60000 +
+           static_cast<int64_t>(s * 1000);
+  }
+  // Kernel "seconds.micros" since boot
+  char *end;
+  const double secs = std::strtod(str.c_str(), &end);
+  if (end != str.c_str() && *end == '\0')
+    return static_cast<int64_t>(secs * 1000);
+  return -1;
+}
+
+bool LogStoreWriter::open(const fs::path &path) {
+  kPath = path.string();
+  fd = ::open(kPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    PLOGE("Failed to open '%s'", kPath.c_str());
+    return false;
+  }
+  if (write(fd, kFileMagic, sizeof(kFileMagic)) != sizeof(kFileMagic)) {
+    PLOGE("Failed to write '%s'", kPath.c_str());
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  offset = sizeof(kFileMagic);
+  block.reserve(kBlockSize + 512);
+  keys.reserve(4096);
+  compressed.resize(compressBound(kBlockSize + 512));
+  return true;
+}
+
+void LogStoreWriter::append(std::string_view line) {
+  LogLine parsed;
+
+  if (fd < 0)
+    return;
+  parseLogLine(line, parsed);
+  if (!parsed.timestamp.empty()) {
+    const auto t = parseLogTimeMs(parsed.timestamp);
+    if (t >= 0)
+      lastTimeMs = t;
+  }
+  // Lines without a timestamp get the previous one
+  if (lines == 0) {
+    minTimeMs = maxTimeMs = lastTimeMs;
+    blockStart = std::chrono::steady_clock::now();
+    keys.clear();
+    severityMask = 0;
+  }
+  minTimeMs = std::min(minTimeMs, lastTimeMs);
+  maxTimeMs = std::max(maxTimeMs, lastTimeMs);
+  severityMask |= 1U << getLogSeverity(parsed);
+  if (!parsed.tag.empty())
+    keys.emplace_back(hashKey('t', parsed.tag));
+  if (parsed.pid >= 0)
+    keys.emplace_back(hashKey('p', std::to_string(parsed.pid)));
+
+  block += line;
+  block += '\n';
+  ++lines;
+  if (block.size() >= kBlockSize || std::chrono::steady_clock::now() - blockStart > kBlockMaxAge)
+    flushBlock();
+}
+
+void LogStoreWriter::flushBlock() {
+  LogBlockIndex idx{};
+  uLongf len = compressed.size();
+
+  if (lines == 0)
+    return;
+  if (compressed.size() < compressBound(block.size()))
+    compressed.resize(compressBound(block.size()));
+  len = compressed.size();
+  // Fastest level, this runs on the capture path
+  if (compress2(reinterpret_cast<Bytef *>(compressed.data()), &len,
+                reinterpret_cast<const Bytef *>(block.data()), block.size(),
+                Z_BEST_SPEED) != Z_OK) {
+    ALOGE("%s: compress2 failed for '%s'", __func__, kPath.c_str());
+    block.clear();
+    lines = 0;
+    return;
+  }
+  // Sized for the tags and pids in this block, a boot logcat block has a
+  // couple hundred of them
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  const uint32_t bits = std::max<uint32_t>(64, (keys.size() * kBloomBitsPerKey + 63) / 64 * 64);
+  bloom.assign(bits / 64, 0);
+  for (const auto k : keys)
+    bloomAdd(bloom, bits, kBloomHashes, k);
+
+  idx.offset = offset;
+  idx.header = {kBlockMagic, static_cast<uint32_t>(block.size()), static_cast<uint32_t>(len),
+                lines, minTimeMs, maxTimeMs, severityMask, bits, kBloomHashes, 0};
+  const ssize_t bloomSize = bloom.size() * sizeof(uint64_t);
+  if (write(fd, &idx.header, sizeof(idx.header)) != sizeof(idx.header) ||
+      write(fd, bloom.data(), bloomSize) != bloomSize ||
+      write(fd, compressed.data(), len) != static_cast<ssize_t>(len)) {
+    PLOGE("Failed to write '%s'", kPath.c_str());
+  } else {
+    offset += blockSize(idx.header);
+    index.emplace_back(idx);
+    rawBytes += block.size();
+    // Same as OutputContext, blocks are larger than a page
+    fsync(fd);
+  }
+  block.clear();
+  lines = 0;
+}
+
+void LogStoreWriter::close() {
+  IndexFooter footer{};
+
+  if (fd < 0)
+    return;
+  flushBlock();
+  footer = {offset, static_cast<uint32_t>(index.size()), kIndexMagic};
+  if (write(fd, index.data(), index.size() * sizeof(LogBlockIndex)) < 0 ||
+      write(fd, &footer, sizeof(footer)) < 0)
+    PLOGE("Failed to write index of '%s'", kPath.c_str());
+  ALOGI("%s: '%s': %zu blocks, %" PRIu64 " bytes compressed to %" PRIu64, __func__,
+        kPath.c_str(), index.size(), rawBytes, offset);
+  ::close(fd);
+  fd = -1;
+}
+
+LogStoreWriter::~LogStoreWriter() {
+  close();
+}
+
+// Reads the index from the footer, or walks block headers if there is none
+static bool readIndex(int fd, std::vector<LogBlockIndex> &index) {
+  struct stat st {};
+  char magic[sizeof(kFileMagic)];
+  IndexFooter footer{};
+
+  if (fstat(fd, &st) != 0 || pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+      memcmp(magic, kFileMagic, sizeof(magic)) != 0)
+    return false;
+  const uint64_t size = st.st_size;
+  if (size >= sizeof(magic) + sizeof(footer) &&
+      pread(fd, &footer, sizeof(footer), size - sizeof(footer)) == sizeof(footer) &&
+      footer.magic == kIndexMagic &&
+      footer.offset + footer.count * sizeof(LogBlockIndex) + sizeof(footer) == size) {
+    index.resize(footer.count);
+    const ssize_t len = footer.count * sizeof(LogBlockIndex);
+    return pread(fd, index.data(), len, footer.offset) == len;
+  }
+  // Not closed properly, the last block may be truncated
+  for (uint64_t off = sizeof(magic); off + sizeof(LogBlockHeader) <= size;) {
+    LogBlockIndex idx{off, {}};
+    if (pread(fd, &idx.header, sizeof(idx.header), off) != sizeof(idx.header) ||
+        idx.header.magic != kBlockMagic || idx.header.bloomBits % 64 != 0 ||
+        off + blockSize(idx.header) > size)
+      break;
+    index.emplace_back(idx);
+    off += blockSize(idx.header);
+  }
+  return true;
+}
+
+struct QueryOptions {
+  int64_t startMs = INT64_MIN, endMs = INT64_MAX;
+  std::vector<std::string> tags;
+  int pid = -1;
+  int minSeverity = 0;
+  bool countOnly = false;
+};
+
+struct QueryStats {
+  uint64_t blocks = 0, blocksRead = 0, lines = 0, matched = 0;
+};
+
+// Checks the header only
+static bool blockMayMatch(const LogBlockHeader &h, const QueryOptions &opts) {
+  if (h.maxTimeMs < opts.startMs || h.minTimeMs > opts.endMs)
+    return false;
+  return (h.severityMask >> opts.minSeverity) != 0;
+}
+
+// Checks the bloom filter of tags and pids, read from [fd] if needed
+static bool blockMayHaveKeys(int fd, const LogBlockIndex &idx, const QueryOptions &opts,
+                             const std::vector<uint64_t> &tagHashes, uint64_t pidHash,
+                             std::vector<uint64_t> &bloom) {
+  const auto &h = idx.header;
+
+  if (opts.pid < 0 && tagHashes.empty())
+    return true;
+  bloom.resize(h.bloomBits / 64);
+  const ssize_t len = bloom.size() * sizeof(uint64_t);
+  if (len == 0 || pread(fd, bloom.data(), len, idx.offset + sizeof(LogBlockHeader)) != len)
+    return true;
+  if (opts.pid >= 0 && !bloomMayContain(bloom, h.bloomBits, h.bloomHashes, pidHash))
+    return false;
+  if (tagHashes.empty())
+    return true;
+  for (const auto t : tagHashes) {
+    if (bloomMayContain(bloom, h.bloomBits, h.bloomHashes, t))
+      return true;
+  }
+  return false;
+}
+
+static bool lineMatches(std::string_view str, const QueryOptions &opts, int64_t &lastTimeMs) {
+  LogLine line;
+
+  parseLogLine(str, line);
+  if (!line.timestamp.empty()) {
+    const auto t = parseLogTimeMs(line.timestamp);
+    if (t >= 0)
+      lastTimeMs = t;
+  }
+  if (lastTimeMs < opts.startMs || lastTimeMs > opts.endMs)
+    return false;
+  if (getLogSeverity(line) < opts.minSeverity)
+    return false;
+  if (opts.pid >= 0 && line.pid != opts.pid)
+    return false;
+  return opts.tags.empty() ||
+         std::find(opts.tags.begin(), opts.tags.end(), line.tag) != opts.tags.end();
+}
+
+static bool queryFile(const std::string &path, const QueryOptions &opts, QueryStats &stats) {
+  std::vector<LogBlockIndex> index;
+  std::vector<uint64_t> tagHashes, bloom;
+  std::string raw, comp;
+  const uint64_t pidHash = hashKey('p', std::to_string(opts.pid));
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open '%s': %s\n", path.c_str(), strerror(errno));
+    return false;
+  }
+  if (!readIndex(fd, index)) {
+    fprintf(stderr, "'%s' is not a log store\n", path.c_str());
+    ::close(fd);
+    return false;
+  }
+  for (const auto &t : opts.tags)
+    tagHashes.emplace_back(hashKey('t', t));
+
+  for (const auto &idx : index) {
+    const auto &h = idx.header;
+    ++stats.blocks;
+    if (!blockMayMatch(h, opts) || !blockMayHaveKeys(fd, idx, opts, tagHashes, pidHash, bloom))
+      continue;
+    ++stats.blocksRead;
+    comp.resize(h.compSize);
+    raw.resize(h.rawSize);
+    uLongf len = h.rawSize;
+    if (pread(fd, comp.data(), h.compSize, idx.offset + blockSize(h) - h.compSize) !=
+            static_cast<ssize_t>(h.compSize) ||
+        uncompress(reinterpret_cast<Bytef *>(raw.data()), &len,
+                   reinterpret_cast<const Bytef *>(comp.data()), h.compSize) != Z_OK) {
+      fprintf(stderr, "'%s': Corrupted block at %" PRIu64 "\n", path.c_str(), idx.offset);
+      continue;
+    }
+    int64_t lastTimeMs = h.minTimeMs;
+    std::string_view sv(raw.data(), len);
+    while (!sv.empty()) {
+      auto end = sv.find('\n');
+      auto line = sv.substr(0, end);
+      sv.remove_prefix(end == std::string_view::npos ? sv.size() : end + 1);
+      ++stats.lines;
+      if (!lineMatches(line, opts, lastTimeMs))
+        continue;
+      ++stats.matched;
+      if (!opts.countOnly) {
+        fwrite(line.data(), 1, line.size(), stdout);
+        fputc('\n', stdout);
+      }
+    }
+  }
+  ::close(fd);
+  return true;
+}
+
+static void queryUsage(const char *argv0) {
+  fprintf(stderr, "Usage: %s query <file.logs|log directory> [options]\n", argv0);
+  fprintf(stderr, "  -s <time>  Start time, seconds since boot or 'MM-DD HH:MM:SS.mmm' (logcat\n");
+  fprintf(stderr, "             captured without -v monotonic)\n");
+  fprintf(stderr, "  -e <time>  End time, same format\n");
+  fprintf(stderr, "  -t <tag>   Only this tag, can be repeated\n");
+  fprintf(stderr, "  -p <pid>   Only this pid\n");
+  fprintf(stderr, "  -l <V|D|I|W|E|F>  Minimum priority\n");
+  fprintf(stderr, "  -c         Only count matching lines\n");
+}
+
+int queryMain(int argc, const char **argv) {
+  const char *argv0 = argv[0];
+  QueryOptions opts;
+  QueryStats stats;
+  std::vector<std::string> files;
+  std::error_code ec;
+
+  // Skip program name and subcommand
+  argc -= 2;
+  argv += 2;
+  if (argc < 1) {
+    queryUsage(argv0);
+    return EXIT_FAILURE;
+  }
+  for (int i = 1; i < argc; ++i) {
+    const std::string opt = argv[i];
+    if (opt == "-c") {
+      opts.countOnly = true;
+      continue;
+    }
+    bool ok = i + 1 < argc;
+    const char *val = ok ? argv[++i] : "";
+    if (opt == "-s")
+      ok &= (opts.startMs = parseLogTimeMs(val)) >= 0;
+    else if (opt == "-e")
+      ok &= (opts.endMs = parseLogTimeMs(val)) >= 0;
+    else if (opt == "-t")
+      opts.tags.emplace_back(val);
+    else if (opt == "-p")
+      ok &= ParseInt(val, &opts.pid, 0);
+    else if (opt == "-l")
+      ok &= strlen(val) == 1 && strchr("VDIWEF", val[0]) && (opts.minSeverity = getLogSeverity(val[0]));
+    else
+      ok = false;
+    if (!ok) {
+      queryUsage(argv0);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (fs::is_directory(argv[0], ec)) {
+    for (const auto &ent : fs::directory_iterator(argv[0], ec)) {
+      if (ent.path().extension() == kLogStoreExt)
+        files.emplace_back(ent.path().string());
+    }
+    std::sort(files.begin(), files.end());
+  } else {
+    files.emplace_back(argv[0]);
+  }
+  if (files.empty()) {
+    fprintf(stderr, "No %s files in '%s'\n", kLogStoreExt, argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  bool ok = true;
+  for (const auto &f : files)
+    ok &= queryFile(f, opts, stats);
+  const std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+  if (opts.countOnly)
+    printf("%" PRIu64 "\n", stats.matched);
+  fprintf(stderr, "%" PRIu64 " lines matched, decompressed %" PRIu64 " of %" PRIu64
+          " blocks (%" PRIu64 " lines) in %.1fms\n", stats.matched, stats.blocksRead,
+          stats.blocks, stats.lines, took.count());
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
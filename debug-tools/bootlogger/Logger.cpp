@@ -15,8 +15,12 @@
  */
 
 #include <android-base/file.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
+#include <android-base/strings.h>
+#include <cctype>
 #include <chrono>
+#include <cinttypes>
 #include <cstdlib>
 #include <errno.h>
 #include <fcntl.h>
@@ -32,6 +36,9 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <regex>
 #include <sstream>
 #include <string>
@@ -42,6 +49,9 @@
 
 using android::base::GetProperty;
 using android::base::GetBoolProperty;
+using android::base::GetIntProperty;
+using android::base::ParseInt;
+using android::base::Split;
 using android::base::WaitForProperty;
 using android::base::WriteStringToFile;
 using std::chrono_literals::operator""s; // NOLINT (misc-unused-using-decls)
@@ -89,13 +99,41 @@ struct OutputContext {
    *
    * @param string data
    */
-  void writeToOutput(const std::string &data) {
-    len += write(fd, data.c_str(), data.size());
+  void writeToOutput(std::string_view data) {
+    if (batch) {
+      if (batch->empty())
+        batch->reserve(batchHint);
+      batch->append(data);
+      batch->push_back('\n');
+      return;
+    }
+    len += write(fd, data.data(), data.size());
     len += write(fd, "\n", 1);
-    if (len > BUF_SIZE) {
-      fsync(fd);
-      len = 0;
+    syncIfNeeded();
+  }
+
+  /**
+   * Collect writes in memory from [mr] until endBatch(), to write them at once
+   *
+   * @param mr Memory resource of the batch, must outlive endBatch()
+   * @param hint Bytes to reserve on the first write
+   */
+  void beginBatch(std::pmr::memory_resource *mr, size_t hint) {
+    batch.emplace(mr);
+    batchHint = hint;
+  }
+
+  /**
+   * Write out the lines collected since beginBatch()
+   */
+  void endBatch() {
+    if (!batch)
+      return;
+    if (!batch->empty()) {
+      len += write(fd, batch->data(), batch->size());
+      syncIfNeeded();
     }
+    batch.reset();
   }
 
   operator bool() const { return fd >= 0; }
@@ -115,9 +153,19 @@ struct OutputContext {
   }
 
 private:
+  void syncIfNeeded() {
+    if (len > BUF_SIZE) {
+      fsync(fd);
+      len = 0;
+    }
+  }
+
   int fd = -1;
   int len = 0;
   bool is_filter = false;
+  // Set between beginBatch() and endBatch()
+  std::optional<std::pmr::string> batch;
+  size_t batchHint = 0;
 };
 
 /**
@@ -125,7 +173,7 @@ private:
  */
 struct LogFilterContext {
   // Function to be invoked to filter
-  virtual bool filter(const std::string &line) const = 0;
+  virtual bool filter(std::string_view line) const = 0;
   // Filter name, must be a vaild file name itself.
   std::string kFilterName;
   // Provide a single constant for regEX usage
@@ -139,6 +187,169 @@ struct LogFilterContext {
   virtual ~LogFilterContext() {}
 };
 
+// Configuration of SpamFilterContext, shared by all loggers
+struct SpamFilterConfig {
+  // Collapse consecutive repeats into "last line repeated N times"
+  bool dedup = false;
+  // Token bucket per tag: refill rate in lines per second, 0 disables it
+  int rate = 0;
+  // Token bucket size, the number of lines allowed in a burst
+  int burst = 0;
+
+  bool enabled() const { return dedup || rate > 0; }
+};
+
+/**
+ * Spam suppression in front of a LoggerContext's own output.
+ * It runs after the filters, so filters still see every captured line.
+ */
+struct SpamFilterContext {
+  /**
+   * Writes the line to [out], unless it is a repeat or rate limited
+   *
+   * @param line captured line
+   * @param out output to write to
+   */
+  void writeLine(std::string_view line, OutputContext &out) {
+    LogLine parsed;
+    TokenBucket *bucket = nullptr;
+
+    ++total_lines;
+    if (!config.enabled()) {
+      out.writeToOutput(line);
+      return;
+    }
+    parseLogLine(line, parsed);
+    if (config.dedup) {
+      // Compare without timestamp, so only the time of the repeat differs
+      if (repeats >= 0 && parsed.body == last_body) {
+        ++repeats;
+        if (last_bucket) {
+          // The line being repeated was rate limited
+          ++last_bucket->dropped;
+          ++last_bucket->dropped_total;
+        }
+        suppress(line);
+        return;
+      }
+      flushRepeats(out);
+      last_body.assign(parsed.body);
+      repeats = 0;
+    }
+    if (config.rate > 0) {
+      key.assign(parsed.tag.empty() ? std::string_view(source) : parsed.tag);
+      bucket = &buckets[key];
+      if (!bucket->take(config)) {
+        ++bucket->dropped;
+        ++bucket->dropped_total;
+        last_bucket = bucket;
+        suppress(line);
+        return;
+      }
+      if (bucket->dropped > 0) {
+        out.writeToOutput(LOG_TAG ": rate limited '" + key + "', dropped " +
+                          std::to_string(bucket->dropped) + " lines");
+        bucket->dropped = 0;
+      }
+    }
+    last_bucket = nullptr;
+    out.writeToOutput(line);
+  }
+
+  /**
+   * Writes pending repeat and drop summaries, and the amount of I/O saved
+   *
+   * @param out output to write to
+   */
+  void flush(OutputContext &out) {
+    if (!config.enabled())
+      return;
+    flushRepeats(out);
+    for (auto &b : buckets) {
+      if (b.second.dropped_total > 0)
+        out.writeToOutput(LOG_TAG ": rate limited '" + b.first + "', dropped " +
+                          std::to_string(b.second.dropped_total) + " lines in total");
+    }
+    auto msg = std::to_string(saved_lines) + " of " + std::to_string(total_lines) +
+               " lines suppressed, saved " + std::to_string(saved_bytes) + " bytes (" +
+               std::to_string(saved_bytes / BUF_SIZE) + " fsyncs)";
+    ALOGI("[Context %s] Spam filter: %s", source.c_str(), msg.c_str());
+    out.writeToOutput(LOG_TAG ": " + msg);
+  }
+
+  SpamFilterContext(const std::string &source) : source(source) {}
+
+  SpamFilterConfig config;
+
+ private:
+  struct TokenBucket {
+    double tokens = -1;
+    std::chrono::steady_clock::time_point last;
+    uint64_t dropped = 0;       // Since last summary line
+    uint64_t dropped_total = 0;
+
+    bool take(const SpamFilterConfig &config) {
+      auto now = std::chrono::steady_clock::now();
+      if (tokens < 0) {
+        tokens = config.burst;
+      } else {
+        std::chrono::duration<double> elapsed = now - last;
+        tokens = std::min<double>(config.burst, tokens + elapsed.count() * config.rate);
+      }
+      last = now;
+      if (tokens < 1)
+        return false;
+      tokens -= 1;
+      return true;
+    }
+  };
+
+  void suppress(std::string_view line) {
+    ++saved_lines;
+    saved_bytes += line.size() + 1;
+  }
+
+  void flushRepeats(OutputContext &out) {
+    if (repeats > 0 && !last_bucket)
+      out.writeToOutput(LOG_TAG ": last line repeated " + std::to_string(repeats) + " times");
+    repeats = -1;
+  }
+
+  std::string source;
+  // Body of the last line, and how many times it was repeated
+  std::string last_body;
+  int repeats = -1;
+  // Set if the last line was dropped by the rate limit
+  TokenBucket *last_bucket = nullptr;
+  // Reused for lookups, to avoid a temporary string per line
+  std::string key;
+  std::unordered_map<std::string, TokenBucket> buckets;
+  uint64_t total_lines = 0, saved_lines = 0, saved_bytes = 0;
+};
+
+/**
+ * User defined filters, from [filter <name>] sections of the config file.
+ * All patterns of all filters are compiled into one MultiRegex, so a line
+ * is scanned once no matter how many filters there are.
+ */
+struct CustomFilterSet {
+  struct Filter {
+    std::string kFilterName;
+    // Output filename, without logger name and extension
+    std::string kOutputName;
+    // Logger names this filter applies to, all if empty
+    std::vector<std::string> kSources;
+
+    bool appliesTo(const std::string &logger) const {
+      return kSources.empty() ||
+             std::find(kSources.begin(), kSources.end(), logger) != kSources.end();
+    }
+  };
+  // Indexed by id in regex
+  std::vector<Filter> filters;
+  MultiRegex regex;
+};
+
 struct LoggerContext : OutputContext {
   /**
    * Opens the log file stream handle
@@ -167,19 +378,76 @@ struct LoggerContext : OutputContext {
     }
   }
 
+  /**
+   * Register user defined filters to this stream.
+   *
+   * @param set The filters to register, only ones applying to this stream are used
+   */
+  void registerCustomFilters(const fs::path logDir, const CustomFilterSet &set) {
+    for (size_t i = 0; i < set.filters.size(); ++i) {
+      const auto &f = set.filters[i];
+      if (!f.appliesTo(name))
+        continue;
+      ALOGD("%s: registered filter '%s' to '%s' logger", __func__,
+            f.kFilterName.c_str(), name.c_str());
+      customFilters.emplace(i, OutputContext(logDir, f.kOutputName + '.' + name, /*isFilter*/ true));
+    }
+    // Own copy, as the DFA cache is not thread safe
+    if (!customFilters.empty())
+      customRegex = set.regex;
+  }
+
+  /**
+   * Enable spam suppression of this stream's own output.
+   * Filters are not affected.
+   *
+   * @param config The configuration to use
+   */
+  void setSpamFilter(const SpamFilterConfig &config) {
+    spam.config = config;
+  }
+
+  /**
+   * Also write this stream to a compressed, indexed log store
+   *
+   * @param logDir directory of the store file
+   * @param only don't write the plain text output
+   */
+  void setLogStore(const fs::path logDir, const bool only) {
+    store = std::make_unique<LogStoreWriter>();
+    if (!store->open(logDir / (name + kLogStoreExt))) {
+      store.reset();
+      return;
+    }
+    store_only = only;
+  }
+
+  /**
+   * Publish this stream's lines to live subscribers
+   *
+   * @param publisher The publisher to use, must not be started yet
+   */
+  void setLivePublisher(std::shared_ptr<LivePublisher> publisher) {
+    live = publisher;
+    if (live)
+      live_source = live->addSource(name);
+  }
+
   /**
    * Start the associated logger
    *
    * @param run Pointer to run/stop control variable
    */
   void startLogger(std::atomic_bool *run) {
-    char buf[512] = {0};
     auto fp = openSource();
     if (fp) {
       if (openOutput()) {
         for (auto &f : filters) {
           f.second.openOutput();
         }
+        for (auto &f : customFilters) {
+          f.second.openOutput();
+        }
         // Erase failed-to-open contexts
         for (auto it = filters.begin(), last = filters.end(); it != last;) {
           if (!it->second)
@@ -187,22 +455,16 @@ struct LoggerContext : OutputContext {
           else
             ++it;
         }
-        while (*run) {
-          auto ret = fgets(buf, sizeof(buf), fp);
-          std::istringstream ss(buf);
-          std::string line;
-          if (ret) {
-            while (std::getline(ss, line)) {
-              for (auto &f : filters) {
-                std::string fline = line;
-                fline.shrink_to_fit();
-                if (f.first->filter(fline))
-                  f.second.writeToOutput(fline);
-              }
-              writeToOutput(line);
-            }
-          }
+        for (auto it = customFilters.begin(), last = customFilters.end(); it != last;) {
+          if (!it->second)
+            it = customFilters.erase(it);
+          else
+            ++it;
         }
+        readLines(fp, run);
+        spam.flush(*this);
+        if (store)
+          store->close();
         // ofstream will auto close
       } else {
         PLOGE("[Context %s] Opening output '%s'", name.c_str(),
@@ -216,14 +478,117 @@ struct LoggerContext : OutputContext {
 
   LoggerContext(decltype(openSource) op, decltype(closeSource) cl, const fs::path logDir,
                 const std::string& name)
-                : OutputContext(logDir, name), openSource(op), closeSource(cl), name(name) {
+                : OutputContext(logDir, name), openSource(op), closeSource(cl), name(name), spam(name) {
     ALOGD("%s: Logger context '%s' created", __func__, name.c_str());
   }
 
  private:
+  // Bytes read from the source at once
+  static constexpr size_t kReadSize = 16 * 1024;
+  // Longer lines are split
+  static constexpr size_t kMaxLineSize = 4096;
+  // Longest batch an output can collect, a whole buffer of lines
+  static constexpr size_t kBatchSize = kMaxLineSize + kReadSize;
+
+  /**
+   * Read the source in batches until [run] is false. Everything a batch needs
+   * comes from an arena which is reset after it, so a line costs no allocation.
+   */
+  void readLines(FILE *fp, std::atomic_bool *run) {
+    const int fd = fileno(fp);
+    // Partial line of the last read stays at the front
+    std::vector<char> buf(kBatchSize);
+    // Per-batch memory, the output buffers of a batch fit in it. Two more for
+    // this output to grow once, as spam summary lines may add to the batch.
+    size_t outputs = 2;
+    forEachOutput([&outputs](OutputContext &) { ++outputs; });
+    std::vector<char> slab(outputs * (kBatchSize + 1));
+    std::pmr::monotonic_buffer_resource arena(slab.data(), slab.size());
+    size_t have = 0;
+    uint64_t lines = 0;
+    const uint64_t allocs = getThreadAllocCount();
+
+    while (*run) {
+      const ssize_t ret = read(fd, buf.data() + have, kReadSize);
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        PLOGE("[Context %s] Reading source", name.c_str());
+        break;
+      }
+      if (ret == 0) {
+        // Writer is gone, don't spin until told to stop
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        continue;
+      }
+      have += ret;
+      forEachOutput([&](OutputContext &out) { out.beginBatch(&arena, have); });
+
+      std::string_view data(buf.data(), have);
+      size_t nl;
+      while ((nl = data.find('\n')) != std::string_view::npos) {
+        processLine(data.substr(0, nl));
+        data.remove_prefix(nl + 1);
+        ++lines;
+      }
+      if (data.size() >= kMaxLineSize) {
+        processLine(data);
+        data = {};
+        ++lines;
+      }
+      have = data.size();
+      memmove(buf.data(), data.data(), have);
+
+      forEachOutput([](OutputContext &out) { out.endBatch(); });
+      arena.release();
+    }
+    if (have > 0)
+      processLine(std::string_view(buf.data(), have));
+    if (getThreadAllocCount() > 0)
+      ALOGI("[Context %s] %" PRIu64 " allocations for %" PRIu64 " lines", name.c_str(),
+            getThreadAllocCount() - allocs, lines);
+  }
+
+  void processLine(std::string_view line) {
+    if (live)
+      live->publish(live_source, line);
+    for (auto &f : filters) {
+      if (f.first->filter(line))
+        f.second.writeToOutput(line);
+    }
+    if (!customFilters.empty() && customRegex.match(line, customMatched)) {
+      for (auto &f : customFilters) {
+        if (MultiRegex::isSet(customMatched, f.first))
+          f.second.writeToOutput(line);
+      }
+    }
+    if (store)
+      store->append(line);
+    if (!store_only)
+      spam.writeLine(line, *this);
+  }
+
+  template <typename Fn>
+  void forEachOutput(Fn fn) {
+    fn(*this);
+    for (auto &f : filters)
+      fn(f.second);
+    for (auto &f : customFilters)
+      fn(f.second);
+  }
+
   std::string name;
   std::unordered_map<std::shared_ptr<LogFilterContext>, OutputContext>
       filters;
+  SpamFilterContext spam;
+  // Indexed by filter id in customRegex
+  std::unordered_map<int, OutputContext> customFilters;
+  MultiRegex customRegex;
+  std::vector<uint64_t> customMatched;
+  std::unique_ptr<LogStoreWriter> store;
+  bool store_only = false;
+  std::shared_ptr<LivePublisher> live;
+  int live_source = -1;
 };
 
 // DMESG
@@ -235,17 +600,18 @@ static void DmesgContext_closeSource(FILE *fp) {
 }
 
 // Logcat
-#define LOGCAT_EXE "/system/bin/logcat"
+// Timestamps since boot, the time base of the timeline and of dmesg
+#define LOGCAT_EXE "/system/bin/logcat -v monotonic"
+// Filter arguments appended to logcat command line, see loadLogcatFilter()
+static std::string kLogcatFilterArgs;
+
 static FILE* LogcatContext_openSource() {
   static const auto kPropBuffer = GetProperty(MAKE_LOGGER_PROP("logcat_buffer"), "");
-  if (kPropBuffer.empty())
-    return popen(LOGCAT_EXE, "r");
-  else {
-    static char buffer[sizeof(LOGCAT_EXE) * 5];
-    std::snprintf(buffer, sizeof(buffer) - 1, LOGCAT_EXE " -b %s || " LOGCAT_EXE, kPropBuffer.c_str());
-    buffer[sizeof(buffer) - 1] = '\0';
-    return popen(buffer, "r");
-  }
+  std::string cmd = LOGCAT_EXE + kLogcatFilterArgs;
+  if (!kPropBuffer.empty())
+    cmd = LOGCAT_EXE " -b " + kPropBuffer + kLogcatFilterArgs + " || " + cmd;
+  ALOGD("%s: Running '%s'", __func__, cmd.c_str());
+  return popen(cmd.c_str(), "r");
 }
 static void LogcatContext_closeSource(FILE *fp) {
   fclose(fp);
@@ -253,45 +619,39 @@ static void LogcatContext_closeSource(FILE *fp) {
 
 // Filters - AVC
 struct AvcFilterContext : LogFilterContext {
-  bool filter(const std::string &line) const override {
-    // Matches "avc: denied { ioctl } for comm=..." for example
-    const static auto kAvcMessageRegEX =
-        std::regex(R"(avc:\s+denied\s+\{(\s\w+)+\s\}\sfor\s)");
-    bool match = std::regex_search(line, kAvcMessageRegEX, kRegexMatchflags);
-    match &= line.find("untrusted_app") == std::string::npos;
+  bool filter(std::string_view line) const override {
+    bool match = isAvcDenial(line);
     if (match && _ctx) {
+      LogLine parsed;
+      parseLogLine(line, parsed);
+      const double time = getLineTimeMs(parsed);
       const std::lock_guard<std::mutex> _(_lock);
-      parseOneAvcContext(line, *_ctx);
+      // Repeats add no rules, only denials with a new permission are parsed
+      if (!_hotspots || _hotspots->add(line, time))
+        parseOneAvcContext(std::string(line), *_ctx);
     }
     return match;
   }
   std::shared_ptr<AvcContexts> _ctx;
+  std::shared_ptr<AvcHotspots> _hotspots;
   std::mutex& _lock;
-  AvcFilterContext(std::shared_ptr<AvcContexts> ctx, std::mutex& lock) :
-    LogFilterContext("avc"), _ctx(ctx), _lock(lock) {}
+  AvcFilterContext(std::shared_ptr<AvcContexts> ctx, std::shared_ptr<AvcHotspots> hotspots,
+                   std::mutex& lock) :
+    LogFilterContext("avc"), _ctx(ctx), _hotspots(hotspots), _lock(lock) {}
   AvcFilterContext() = delete;
   ~AvcFilterContext() override = default;
 };
 
 // Filters - libc property
 struct libcPropFilterContext : LogFilterContext {
-  bool filter(const std::string &line) const override {
-    // libc : Access denied finding property "
-    const static auto kPropertyAccessRegEX =
-        std::regex(R"(libc\s+:\s+\w+\s\w+\s\w+\s\w+\s\")");
+  bool filter(std::string_view line) const override {
     static std::vector<std::string> propsDenied;
-    std::smatch kPropMatch;
+    std::string_view prop;
 
     // Matches "libc : Access denied finding property ..."
-    if (std::regex_search(line, kPropMatch, kPropertyAccessRegEX,
-                          kRegexMatchflags)) {
-      // Trim property name from "property: \"ro.a.b\""
-      // line: property "{prop name}"
-      std::string prop = kPropMatch.suffix();
-      // line: {prop name}"
-      prop = prop.substr(0, prop.find_first_of('"'));
+    if (findDeniedProperty(line, prop)) {
       // Starts with ctl. ?
-      if (prop.find("ctl.") == 0)
+      if (prop.substr(0, 4) == "ctl.")
         return true;
       // Cache the properties
       if (std::find(propsDenied.begin(), propsDenied.end(), prop) == propsDenied.end()) {
@@ -301,10 +661,193 @@ struct libcPropFilterContext : LogFilterContext {
     }
     return false;
   }
+
+  /**
+   * Same as R"(libc\s+:\s+\w+\s\w+\s\w+\s\w+\s\")" followed by the property name,
+   * without std::regex as it allocates for every search.
+   *
+   * @param line captured line
+   * @param prop set to the property name, pointing into [line]
+   * @return true if found
+   */
+  static bool findDeniedProperty(std::string_view line, std::string_view &prop) {
+    auto isSpace = [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+    auto isWord = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+
+    for (size_t idx = line.find("libc"); idx != std::string_view::npos;
+         idx = line.find("libc", idx + 1)) {
+      auto sv = line.substr(idx + 4);
+      auto skip = [&sv](auto pred, bool many) {
+        size_t n = 0;
+        while (n < sv.size() && pred(sv[n]) && (many || n == 0))
+          ++n;
+        sv.remove_prefix(n);
+        return n > 0;
+      };
+      if (!skip(isSpace, true) || sv.empty() || sv.front() != ':')
+        continue;
+      sv.remove_prefix(1);
+      // "Access denied finding property", four words
+      bool ok = skip(isSpace, true);
+      for (int i = 0; i < 4 && ok; ++i)
+        ok = skip(isWord, true) && skip(isSpace, false);
+      if (!ok || sv.empty() || sv.front() != '"')
+        continue;
+      // {prop name}"
+      sv.remove_prefix(1);
+      prop = sv.substr(0, sv.find('"'));
+      return true;
+    }
+    return false;
+  }
   libcPropFilterContext() : LogFilterContext("libc_props") {}
   ~libcPropFilterContext() override = default;
 };
 
+// persist.ext.logdump.dedup: bool
+// persist.ext.logdump.ratelimit: "rate,burst", in lines per second per tag
+static SpamFilterConfig loadSpamFilterConfig() {
+  SpamFilterConfig config;
+  auto kPropRateLimit = GetProperty(MAKE_LOGGER_PROP("ratelimit"), "");
+
+  config.dedup = GetBoolProperty(MAKE_LOGGER_PROP("dedup"), false);
+  if (!kPropRateLimit.empty()) {
+    auto v = Split(kPropRateLimit, ",");
+    if (v.size() == 2 && ParseInt(v[0], &config.rate, 1) && ParseInt(v[1], &config.burst, 1)) {
+      ALOGI("Rate limiting to %d lines/s per tag, burst %d", config.rate, config.burst);
+    } else {
+      ALOGW("Invalid ratelimit config: '%s'", kPropRateLimit.c_str());
+      config.rate = config.burst = 0;
+    }
+  }
+  if (config.dedup)
+    ALOGI("Collapsing repeated lines");
+  return config;
+}
+
+/**
+ * Build logcat filter arguments from filterspecs and a pid.
+ * Sources are persist.ext.logdump.logcat_filter ("Tag:P ...") and
+ * persist.ext.logdump.logcat_pid, or 'filter' and 'pid' keys in [logcat]
+ * section of the config file.
+ *
+ * The pid is passed down to logd's reader, and logcat drops entries that do not
+ * match the tag/priority specs before formatting them, so filtered out entries
+ * never reach the pipe, filters or output files.
+ * Note that AVC/libc filters only see what passes, keep 'auditd' and 'libc'
+ * tags in the specs if those are needed.
+ */
+static std::string loadLogcatFilter(const LoggerConfig_t &config) {
+  const static std::regex kFilterSpecRegEX(R"(^([\w.\-/@]+|\*):[VDIWEFS*]$)");
+  const auto *section = findConfigSection(config, "logcat");
+  std::vector<std::string> specs;
+  std::string args, pid;
+  bool hasWildcard = false;
+
+  auto addSpecs = [&](const std::string &value) {
+    for (const auto &spec : Split(value, " ")) {
+      if (spec.empty())
+        continue;
+      if (!std::regex_match(spec, kFilterSpecRegEX)) {
+        ALOGW("Invalid logcat filterspec: '%s'", spec.c_str());
+        continue;
+      }
+      hasWildcard |= spec.front() == '*';
+      specs.emplace_back(spec);
+    }
+  };
+
+  addSpecs(GetProperty(MAKE_LOGGER_PROP("logcat_filter"), ""));
+  pid = GetProperty(MAKE_LOGGER_PROP("logcat_pid"), "");
+  if (section) {
+    for (const auto &value : section->getAll("filter"))
+      addSpecs(value);
+    pid = section->get("pid", pid);
+  }
+  // Silence everything not mentioned, else logcat prints it at default priority
+  if (!specs.empty() && !hasWildcard)
+    specs.emplace_back("*:S");
+  for (const auto &spec : specs)
+    args += ' ' + spec;
+  if (!pid.empty()) {
+    int value;
+    if (ParseInt(pid, &value, 1))
+      args += " --pid=" + std::to_string(value);
+    else
+      ALOGW("Invalid logcat pid: '%s'", pid.c_str());
+  }
+  if (!args.empty())
+    ALOGI("Logcat filter:%s", args.c_str());
+  return args;
+}
+
+/**
+ * Load user defined filters from the config file. For example:
+ *
+ * [filter binder]
+ * pattern = binder: \d+:\d+ transaction failed
+ * pattern = binder_alloc: .* no vma
+ * output = binder_errors   (Optional, defaults to filter name)
+ * source = logcat dmesg    (Optional, defaults to all loggers)
+ * icase = true             (Optional, defaults to false)
+ */
+static void loadCustomFilters(const LoggerConfig_t &config, CustomFilterSet &set) {
+  const static std::regex kFileNameRegEX(R"(^[\w.\-]+$)");
+  const static std::string kSectionPrefix = "filter ";
+
+  for (const auto &section : config) {
+    if (section.name.find(kSectionPrefix) != 0)
+      continue;
+    CustomFilterSet::Filter filter;
+    MultiRegex validate;
+    std::string error;
+    const int id = set.filters.size();
+    const bool icase = section.get("icase") == "true";
+    const auto patterns = section.getAll("pattern");
+    bool valid = !patterns.empty();
+
+    filter.kFilterName = section.name.substr(kSectionPrefix.size());
+    filter.kOutputName = section.get("output", filter.kFilterName);
+    for (const auto &src : Split(section.get("source"), " ,")) {
+      if (!src.empty())
+        filter.kSources.emplace_back(src);
+    }
+    if (!std::regex_match(filter.kOutputName, kFileNameRegEX)) {
+      ALOGE("Filter '%s': Invalid output name '%s'", filter.kFilterName.c_str(),
+            filter.kOutputName.c_str());
+      continue;
+    }
+    // Check all patterns first, so a half-added filter cannot match
+    for (const auto &pattern : patterns) {
+      if (!validate.add(pattern, 0, icase, &error)) {
+        ALOGE("Filter '%s': Invalid pattern '%s': %s", filter.kFilterName.c_str(),
+              pattern.c_str(), error.c_str());
+        valid = false;
+      }
+    }
+    if (!valid) {
+      ALOGE("Filter '%s': Ignored", filter.kFilterName.c_str());
+      continue;
+    }
+    for (const auto &pattern : patterns)
+      set.regex.add(pattern, id, icase);
+    ALOGI("Loaded filter '%s' with %zu pattern(s)", filter.kFilterName.c_str(), patterns.size());
+    set.filters.emplace_back(std::move(filter));
+  }
+}
+
+// Filters - Boot timeline, only collects events and writes no lines itself
+struct TimelineFilterContext : LogFilterContext {
+  bool filter(std::string_view line) const override {
+    _timeline->onLine(line);
+    return false;
+  }
+  std::shared_ptr<BootTimeline> _timeline;
+  TimelineFilterContext(std::shared_ptr<BootTimeline> timeline) :
+    LogFilterContext("timeline"), _timeline(timeline) {}
+  ~TimelineFilterContext() override = default;
+};
+
 using std::chrono::duration_cast;
 
 static void recordBootTime() {
@@ -333,8 +876,20 @@ int main(int argc, const char** argv) {
   int rc;
   std::mutex lock;
 
+  if (argc >= 2 && strcmp(argv[1], "compare") == 0)
+    return compareMain(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "query") == 0)
+    return queryMain(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "analyze") == 0)
+    return analyzeMain(argc, argv);
+  if (argc >= 2 && strcmp(argv[1], "follow") == 0)
+    return followMain(argc, argv);
   if (argc != 2) {
     fprintf(stderr, "Usage: %s [log directory]\n", argv[0]);
+    fprintf(stderr, "       %s compare [log directory] [options]\n", argv[0]);
+    fprintf(stderr, "       %s query <file.logs|log directory> [options]\n", argv[0]);
+    fprintf(stderr, "       %s analyze [options] <log files...>\n", argv[0]);
+    fprintf(stderr, "       %s follow [filters...]\n", argv[0]);
     return EXIT_FAILURE;
   }
   kLogRoot = argv[1];
@@ -343,6 +898,11 @@ int main(int argc, const char** argv) {
     return EXIT_FAILURE;
   }
   auto kLogDir = fs::path(kLogRoot);
+  // Those live in log root, and are kept when clearing the directory
+  const auto kHistoryPath = fs::path(kLogRoot) / kHistoryDir;
+  const auto kConfigPath = GetProperty(MAKE_LOGGER_PROP("config"),
+                                       (fs::path(kLogRoot) / "logger.conf").string());
+  LoggerConfig_t kLoggerConfig;
 
   if (getenv("LOGGER_MODE_SYSTEM") != NULL) {
      ALOGI("Running in system log mode");
@@ -365,14 +925,32 @@ int main(int argc, const char** argv) {
     kLogDir,
     "logcat"
   };
+  const auto kSpamConfig = loadSpamFilterConfig();
+  CustomFilterSet kCustomFilters;
   auto kAvcCtx = std::make_shared<std::vector<AvcContext>>();
-  auto kAvcFilter = std::make_shared<AvcFilterContext>(kAvcCtx, lock);
+  // Denials per time bucket are optional, 0 disables
+  auto kAvcHotspots = std::make_shared<AvcHotspots>(
+      GetIntProperty(MAKE_LOGGER_PROP("avc_rate_ms"), 0, 0, 3600000));
+  auto kAvcFilter = std::make_shared<AvcFilterContext>(kAvcCtx, kAvcHotspots, lock);
   auto kLibcPropsFilter = std::make_shared<libcPropFilterContext>();
+  std::shared_ptr<BootTimeline> kTimeline;
+  std::shared_ptr<TimelineFilterContext> kTimelineFilter;
   bool ever_removed = false;
 
   ALOGI("Logger starting with logdir '%s' ...", kLogDir.c_str());
 
+  rc = ReadLoggerConfig(kConfigPath, kLoggerConfig);
+  if (rc == 0) {
+    ALOGI("Loaded config '%s'", kConfigPath.c_str());
+  } else if (rc > 0) {
+    ALOGW("Error(s) were found parsing '%s'", kConfigPath.c_str());
+  }
+  kLogcatFilterArgs = loadLogcatFilter(kLoggerConfig);
+  loadCustomFilters(kLoggerConfig, kCustomFilters);
+
   for (auto const& ent : fs::directory_iterator(system_log ? kLogDir : fs::path(kLogRoot), ec)) {
+    if (ent.path() == kConfigPath || ent.path() == kHistoryPath)
+      continue;
     if (fs::is_directory(ent, ec))
       fs::remove_all(ent, ec);
     else
@@ -402,6 +980,7 @@ int main(int argc, const char** argv) {
       ALOGI("Kernel configuration does not have CONFIG_AUDIT=y, disabling avc filters.");
       kAvcFilter.reset();
       kAvcCtx.reset();
+      kAvcHotspots.reset();
     }
   }
 
@@ -413,20 +992,74 @@ int main(int argc, const char** argv) {
   }
   run = true;
 
+  // Timeline is only meaningful while booting
+  if (!system_log) {
+    kTimeline = std::make_shared<BootTimeline>();
+    kTimelineFilter = std::make_shared<TimelineFilterContext>(kTimeline);
+  }
+  kDmesgCtx.setSpamFilter(kSpamConfig);
+  kLogcatCtx.setSpamFilter(kSpamConfig);
+  // "true" writes the log store next to the text logs, "only" instead of them
+  const auto kPropStore = GetProperty(MAKE_LOGGER_PROP("store"), "");
+  if (kPropStore == "true" || kPropStore == "only") {
+    kDmesgCtx.setLogStore(kLogDir, kPropStore == "only");
+    kLogcatCtx.setLogStore(kLogDir, kPropStore == "only");
+  }
+
+  // Live stream for 'logger follow', off by default
+  std::shared_ptr<LivePublisher> kLive;
+  if (GetBoolProperty(MAKE_LOGGER_PROP("live"), false)) {
+    kLive = std::make_shared<LivePublisher>(
+        GetIntProperty(MAKE_LOGGER_PROP("live_ring_kb"), 1024, 64, 65536) * 1024);
+    kDmesgCtx.setLivePublisher(kLive);
+    kLogcatCtx.setLivePublisher(kLive);
+    if (!kLive->start(system_log ? kLiveSystemSocketName : kLiveSocketName, &run)) {
+      kDmesgCtx.setLivePublisher(nullptr);
+      kLogcatCtx.setLivePublisher(nullptr);
+    }
+  }
+
   // If this prop is true, logd logs kernel message to logcat
   // Don't make duplicate (Also it will race against kernel logs)
   if (!GetBoolProperty("ro.logd.kernel", false)) {
     kDmesgCtx.registerLogFilter(kLogDir, kAvcFilter);
+    kDmesgCtx.registerLogFilter(kLogDir, kTimelineFilter);
+    kDmesgCtx.registerCustomFilters(kLogDir, kCustomFilters);
     threads.emplace_back(std::thread([&] { kDmesgCtx.startLogger(&run); }));
   }
   kLogcatCtx.registerLogFilter(kLogDir, kAvcFilter);
   kLogcatCtx.registerLogFilter(kLogDir, kLibcPropsFilter);
+  kLogcatCtx.registerLogFilter(kLogDir, kTimelineFilter);
+  kLogcatCtx.registerCustomFilters(kLogDir, kCustomFilters);
   threads.emplace_back(std::thread([&] { kLogcatCtx.startLogger(&run); }));
 
+  // 0 disables the sampler, on by default while booting
+  const int kSampleIntervalMs = GetIntProperty(MAKE_LOGGER_PROP("sample_interval_ms"),
+                                               system_log ? 0 : 200, 0, 60000);
+  std::unique_ptr<ResourceSampler> kSampler;
+  if (kSampleIntervalMs > 0) {
+    kSampler = std::make_unique<ResourceSampler>(
+        kSampleIntervalMs, GetIntProperty(MAKE_LOGGER_PROP("sample_budget_pct"), 1, 1, 100));
+    if (kSampler->open(kLogDir))
+      threads.emplace_back(std::thread([&] { kSampler->run(&run); }));
+  }
+  // Per-process accounting costs more, so samples less often
+  const int kProcIntervalMs = GetIntProperty(MAKE_LOGGER_PROP("proc_sample_interval_ms"),
+                                             system_log ? 0 : 500, 0, 60000);
+  std::unique_ptr<ProcessSampler> kProcSampler;
+  if (kProcIntervalMs > 0) {
+    kProcSampler = std::make_unique<ProcessSampler>(
+        kProcIntervalMs, GetIntProperty(MAKE_LOGGER_PROP("sample_budget_pct"), 1, 1, 100),
+        GetIntProperty(MAKE_LOGGER_PROP("proc_top_n"), 20, 1, 1000));
+    if (kProcSampler->open(kLogDir))
+      threads.emplace_back(std::thread([&] { kProcSampler->run(&run); }));
+  }
+
   if (system_log) {
     WaitForProperty(MAKE_LOGGER_PROP("enabled"), "false");
   } else {
     WaitForProperty("sys.boot_completed", "1");
+    kTimeline->markPhase("boot_completed");
     recordBootTime();
 
     // Delay a bit to finish
@@ -436,23 +1069,21 @@ int main(int argc, const char** argv) {
   for (auto &i : threads)
     i.join();
 
+  if (kTimeline) {
+    kTimeline->write(kLogDir);
+    saveBootHistory(kHistoryPath, kTimeline->getEvents(),
+                    GetIntProperty(MAKE_LOGGER_PROP("history_size"), 10, 1, 1000));
+  }
+
+  if (kAvcHotspots)
+    kAvcHotspots->write(kLogDir, 10);
   if (kAvcCtx) {
-    std::vector<std::string> allowrules;
-    OutputContext seGenCtx(kLogDir, "sepolicy.gen.txt");
-    for (auto& e1 : *kAvcCtx) {
-      for (auto& e2 : *kAvcCtx) {
-        if (&e1 == &e2) continue;
-        e1 += e2;
-      }
-    }
-    for (const auto& e : *kAvcCtx) {
-      std::string line;
-      writeAllowRules(e, line);
-      allowrules.emplace_back(line);
+    OutputContext seGenCtx(kLogDir, "sepolicy.gen");
+    if (seGenCtx.openOutput()) {
+      // Rules are new line terminated already
+      for (const auto& l : makeAllowRules(*kAvcCtx))
+        seGenCtx.writeToOutput(l.substr(0, l.size() - 1));
     }
-    eraseDuplicates(allowrules);
-    for (const auto& l : allowrules)
-      seGenCtx.writeToOutput(l);
   }
   return 0;
 }
@@ -0,0 +1,70 @@
+#include <android-base/strings.h>
+
+#include <fstream>
+#include <string>
+
+#include "LoggerInternal.h"
+
+using android::base::Trim;
+
+int ReadLoggerConfig(const std::string &path, LoggerConfig_t &out) {
+  std::ifstream file(path);
+  std::string line;
+  int rc = 0, lineno = 0;
+
+  if (!file) {
+    return -errno;
+  }
+  out.clear();
+  // Entries before any section header go to an unnamed one
+  out.emplace_back();
+  while (std::getline(file, line)) {
+    ++lineno;
+    line = Trim(line);
+    if (line.empty() || line.front() == '#')
+      continue;
+    if (line.front() == '[') {
+      if (line.back() != ']') {
+        ALOGW("%s:%d: Unterminated section header", path.c_str(), lineno);
+        rc = 1;
+        continue;
+      }
+      out.emplace_back();
+      out.back().name = Trim(line.substr(1, line.size() - 2));
+      continue;
+    }
+    auto idx = line.find('=');
+    if (idx == std::string::npos) {
+      ALOGW("%s:%d: Unparsable line: '%s'", path.c_str(), lineno, line.c_str());
+      rc = 1;
+      continue;
+    }
+    out.back().entries.emplace_back(Trim(line.substr(0, idx)), Trim(line.substr(idx + 1)));
+  }
+  return rc;
+}
+
+std::vector<std::string> ConfigSection::getAll(const std::string &key) const {
+  std::vector<std::string> ret;
+  for (const auto &e : entries) {
+    if (e.first == key)
+      ret.emplace_back(e.second);
+  }
+  return ret;
+}
+
+std::string ConfigSection::get(const std::string &key, const std::string &def) const {
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+    if (it->first == key)
+      return it->second;
+  }
+  return def;
+}
+
+const ConfigSection *findConfigSection(const LoggerConfig_t &config, const std::string &name) {
+  for (const auto &s : config) {
+    if (s.name == name)
+      return &s;
+  }
+  return nullptr;
+}
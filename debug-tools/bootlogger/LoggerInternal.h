@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstring>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 #define LOG_TAG "bootlogger"
@@ -102,3 +103,591 @@ bool parseOneAvcContext(const std::string &str, AvcContexts &outvec);
  * @return true on success
  */
 bool writeAllowRules(const AvcContext &ctx, std::string &out);
+
+/**
+ * isAvcDenial - whether the line is an AVC denial to generate rules for
+ * untrusted_app denials are excluded.
+ *
+ * @param line log line
+ * @return true if it is
+ */
+bool isAvcDenial(std::string_view line);
+
+/**
+ * mergeAvcContexts - merge contexts that differ only in operations
+ * Merged ones are removed from the vector.
+ *
+ * @param vec contexts to merge
+ */
+void mergeAvcContexts(AvcContexts &vec);
+
+/**
+ * makeAllowRules - merge contexts and generate sorted, unique allow rules
+ *
+ * @param vec contexts, merged in place
+ * @return rules, new line terminated
+ */
+std::vector<std::string> makeAllowRules(AvcContexts &vec);
+
+// AvcHotspots.cpp
+#include <filesystem>
+
+/**
+ * Counts AVC denials per (scontext, tcontext, tclass, perm), with first and
+ * last time seen and optionally the count per time bucket. Keys live in one
+ * string pool and entries in an open addressing table, so only the first
+ * occurrence of a denial allocates. Not thread safe.
+ */
+class AvcHotspots {
+ public:
+  // [rateBucketMs] 0 disables counting per time bucket
+  explicit AvcHotspots(int rateBucketMs = 0);
+
+  // Count a denial line, [timeMs] in CLOCK_MONOTONIC milliseconds.
+  // Returns true if any of its permissions was not seen before.
+  bool add(std::string_view line, double timeMs);
+  // Write avc_hotspots.txt, and avc_rate.csv with the [topN] denials if enabled
+  bool write(const std::filesystem::path &dir, size_t topN) const;
+
+ private:
+  struct Entry {
+    uint64_t hash = 0;
+    uint32_t key = 0;  // Offset in pool, parts follow each other
+    uint16_t len[4] = {};
+    uint32_t count = 0;  // 0 if unused
+    uint32_t rate = 0;   // Offset in rates
+    double firstMs = 0, lastMs = 0;
+  };
+  // Rate buckets per entry, the last one also counts anything later
+  static constexpr size_t kRateBuckets = 300;
+
+  std::string_view part(const Entry &e, int i) const;
+  Entry &find(uint64_t hash, const std::string_view (&parts)[4]);
+  void grow();
+  std::vector<const Entry *> sorted() const;
+
+  const int kRateBucketMs;
+  std::vector<Entry> table;
+  size_t used = 0;
+  std::string pool;
+  std::vector<uint32_t> rates;
+};
+
+// LogLine.cpp
+struct LogLine {
+  // "10-18 12:34:56.789" or "1.234" (logcat -v monotonic), "1.234567" (kmsg)
+  std::string_view timestamp;
+  std::string_view body;      // Line without the timestamp
+  std::string_view tag;       // Logcat tag, or driver prefix for kmsg. May be empty
+  std::string_view message;   // Text after the tag
+  int pid = -1, tid = -1;
+  char priority = '\0';       // V/D/I/W/E/F for logcat, '0'...'7' for kmsg
+  bool kernel = false;
+};
+
+/**
+ * parseLogLine - split a logcat (threadtime, optionally monotonic) or kmsg line into its parts
+ * Views point into [line], so it must outlive [out].
+ *
+ * @param line input line, without newline
+ * @param out parsed line. If parsing fails, body and message are the whole line
+ * @return true if the line was in a known format
+ */
+bool parseLogLine(std::string_view line, LogLine &out);
+
+// Whether [ts] is "seconds.fraction" since boot, rather than a date
+bool isMonotonicTimestamp(std::string_view ts);
+
+// Android log priority of the line, 2 (verbose) to 7 (fatal). Kernel levels are mapped onto those.
+int getLogSeverity(const LogLine &line);
+// Same, for a logcat priority letter
+int getLogSeverity(char priority);
+
+// LoggerConfig.cpp
+struct ConfigSection {
+  std::string name; // Empty for entries before the first [section]
+  std::vector<std::pair<std::string, std::string>> entries;
+
+  // All values of [key], in file order
+  std::vector<std::string> getAll(const std::string &key) const;
+  // Last value of [key], or [def] if not present
+  std::string get(const std::string &key, const std::string &def = "") const;
+};
+
+using LoggerConfig_t = std::vector<ConfigSection>;
+
+/**
+ * Read a logger configuration file, in the format:
+ *
+ * # comment
+ * [section]
+ * key = value
+ *
+ * @param path path of the file
+ * @param out buffer to store
+ * @return 0 on success, negative errno if the file cannot be opened,
+ *         1 if some lines were ignored
+ */
+int ReadLoggerConfig(const std::string &path, LoggerConfig_t &out);
+
+// Returns the first section named [name], or nullptr
+const ConfigSection *findConfigSection(const LoggerConfig_t &config, const std::string &name);
+
+// MultiRegex.cpp
+#include <array>
+#include <bitset>
+
+/**
+ * Matches a set of regular expressions against a line in a single pass.
+ * All patterns are compiled into one NFA, which is turned into a DFA lazily
+ * while matching, so the per-line cost barely depends on the number of patterns.
+ *
+ * Supports literals, ., [...], \w \d \s, groups, |, * + ? {m,n}, ^ and $, with
+ * the same meaning as in std::regex ECMAScript (^ and $ match at the line ends only).
+ * Not thread safe, as matching fills the DFA cache. Use a copy per thread.
+ */
+class MultiRegex {
+ public:
+  /**
+   * Add a pattern
+   *
+   * @param pattern regular expression
+   * @param id bit set in match() result when this pattern matches, ids may be shared
+   * @param icase match case insensitive
+   * @param error if non null, receives the reason of failure
+   * @return true on success
+   */
+  bool add(const std::string &pattern, int id, bool icase = false, std::string *error = nullptr);
+
+  /**
+   * Search all patterns in the line
+   *
+   * @param line input line
+   * @param matched bitmask of matched ids, resized to fit
+   * @return true if any pattern matched
+   */
+  bool match(std::string_view line, std::vector<uint64_t> &matched);
+
+  static bool isSet(const std::vector<uint64_t> &matched, int id) {
+    return matched[id / 64] & (1ULL << (id % 64));
+  }
+
+  // Number of ids, one larger than the largest id added
+  int size() const { return idCount; }
+
+ private:
+  using CharSet = std::bitset<256>;
+  struct Node;
+  struct Parser;
+
+  enum StateType {
+    STATE_CHARS,  // Consume a byte in [chars], go to out
+    STATE_SPLIT,  // Epsilon to out and out1
+    STATE_BOL,    // Epsilon to out at start of line only
+    STATE_EOL,    // Epsilon to out at end of line only
+    STATE_MATCH,  // Pattern [id] matched
+  };
+  struct NState {
+    StateType type;
+    int out, out1;
+    int id;
+    CharSet chars;
+  };
+  struct DState {
+    std::vector<int> nfa;             // Sorted NFA states
+    std::vector<uint64_t> accept;     // ids matched when reaching this state
+    std::vector<uint64_t> eolAccept;  // ids matched if the line ends here
+    bool accepting = false;
+    std::array<int, 256> next;        // -1 if not computed yet
+  };
+  // Bound for the lazily built DFA, it is flushed when exceeded
+  static constexpr size_t kMaxCachedStates = 2048;
+
+  int newState(StateType type, int out = -1, int out1 = -1);
+  int compileNode(const Node &node, int next);
+  // [atStart] and [atEnd] tell whether ^ and $ pass at this position
+  void addClosure(int s, std::vector<int> &set, std::vector<bool> &seen, bool atStart,
+                  bool atEnd) const;
+  // Sets the ids matched if the line ends right after [set]
+  bool eolMatches(const std::vector<int> &set, bool atStart, std::vector<uint64_t> &ids) const;
+  int findOrAddState(std::vector<int> &set);
+  int step(int from, unsigned char c);
+  int startState();
+  void resetCache();
+  size_t wordCount() const { return (idCount + 63) / 64; }
+
+  std::vector<NState> nfa;
+  std::vector<int> anchoredStarts, floatingStarts;
+  int idCount = 0;
+
+  std::vector<DState> dfa;
+  std::map<std::vector<int>, int> stateIndex;
+  int start = -1;
+  // eolAccept of the start state, when it is also the end of the line
+  std::vector<uint64_t> emptyLineAccept;
+};
+
+// BootTimeline.cpp
+#include <filesystem>
+#include <mutex>
+
+// CLOCK_MONOTONIC in milliseconds, the time base of the timeline
+double getMonotonicMs();
+
+// Time of a line in CLOCK_MONOTONIC milliseconds, from its timestamp. Lines
+// without one since boot are stamped with the time of capture.
+double getLineTimeMs(const LogLine &line);
+
+struct TimelineEvent {
+  enum Type {
+    PHASE,    // Init action trigger, system_server boot phase...
+    SERVICE,  // Init service from start to exit
+    COMMAND,  // Anything reported with 'took Xms'
+  } type;
+  std::string name;
+  double startMs;
+  double durationMs;  // Negative if unknown (still running, or instant)
+  std::string detail;
+};
+
+/**
+ * Builds a boot timeline out of captured lines: init action triggers,
+ * service start/exit, 'took Xms' messages and system_server boot phases.
+ */
+class BootTimeline {
+ public:
+  // Feed a captured line, thread safe
+  void onLine(std::string_view line);
+  // Record a phase at the current time, like boot_completed
+  void markPhase(const std::string &name);
+  // Sorted by start time, with phase durations filled in
+  std::vector<TimelineEvent> getEvents();
+
+  /**
+   * Write timeline.csv, timeline.json and boottrace.json
+   * (Chrome JSON trace format, can be opened with Perfetto UI)
+   *
+   * @param dir directory to write to
+   * @return true on success
+   */
+  bool write(const std::filesystem::path &dir);
+
+ private:
+  void onInitLine(const LogLine &line, double time);
+  void onSystemServerLine(const LogLine &line, double time);
+  // Needs lock held
+  void addPhase(const std::string &name, double time);
+
+  std::mutex lock;
+  std::vector<TimelineEvent> events;
+  // Service name to its index in events, until it exits
+  std::unordered_map<std::string, size_t> runningServices;
+};
+
+// Escape [str] for a JSON string or a CSV field
+std::string escapeJson(const std::string &str);
+std::string escapeCsv(const std::string &str);
+
+// BootHistory.cpp
+// Subdirectory of log root keeping per-boot timeline summaries
+#define kHistoryDir "history"
+
+/**
+ * Save a summary of this boot's timeline, keeping [keep] boots at most
+ *
+ * @param dir history directory
+ * @param events timeline events
+ * @param keep number of boots to keep, including this one
+ * @return true on success
+ */
+bool saveBootHistory(const std::filesystem::path &dir, const std::vector<TimelineEvent> &events,
+                     int keep);
+
+// 'logger compare' subcommand
+int compareMain(int argc, const char **argv);
+
+// ResourceSampler.cpp
+#include <unistd.h>
+
+#include <atomic>
+
+// pread(2) [fd] from offset 0 into [buf], NUL terminated. Returns the length, or -1
+ssize_t readProcFd(int fd, char *buf, size_t size);
+// Same, until the end of the file. [buf] is grown as needed, and kept for the next read
+ssize_t readProcFile(int fd, std::vector<char> &buf);
+// Value after "key=" or "key:" in [from], 0 if not found
+uint64_t findProcValue(const char *from, const char *key);
+
+/**
+ * Calls sample() at an interval until stopped, measuring the CPU time it
+ * takes. The interval is doubled if sampling costs more than the budget.
+ */
+class PeriodicSampler {
+ public:
+  PeriodicSampler(const char *name, int intervalMs, double budgetPct)
+      : kName(name), kIntervalMs(intervalMs), kBudgetPct(budgetPct) {}
+  virtual ~PeriodicSampler() = default;
+
+  // Sample until [run] is false
+  void run(std::atomic_bool *run);
+
+ protected:
+  // Take one sample, the first call is right after run()
+  virtual void sample() = 0;
+  // Called once after the last sample
+  virtual void finish() {}
+
+ private:
+  const char *kName;
+  const int kIntervalMs;
+  const double kBudgetPct;
+};
+
+/**
+ * Samples system wide PSI, CPU, memory and disk counters and writes them to
+ * resources.csv, with CLOCK_MONOTONIC timestamps like the timeline and
+ * kernel log. Files are opened once and read with pread(2).
+ */
+class ResourceSampler : public PeriodicSampler {
+ public:
+  ResourceSampler(int intervalMs, double budgetPct)
+      : PeriodicSampler("ResourceSampler", intervalMs, budgetPct) {}
+  ~ResourceSampler() override;
+
+  // Open sources and resources.csv in [dir]
+  bool open(const std::filesystem::path &dir);
+
+ protected:
+  void sample() override;
+  void finish() override;
+
+ private:
+  struct Counters {
+    double timeMs = 0;
+    uint64_t cpuTotal = 0, cpuIdle = 0, cpuIowait = 0;  // jiffies
+    uint64_t psiCpuSome = 0, psiCpuFull = 0;            // microseconds
+    uint64_t psiMemSome = 0, psiMemFull = 0;
+    uint64_t psiIoSome = 0, psiIoFull = 0;
+    uint64_t memAvailableKb = 0, memCachedKb = 0;
+    uint64_t sectorsRead = 0, sectorsWritten = 0;
+  };
+
+  void readPressure(int fd, uint64_t &some, uint64_t &full);
+  void read(Counters &c);
+  void writeSample(const Counters &prev, const Counters &cur);
+  void flush();
+
+  int fdPsiCpu = -1, fdPsiMem = -1, fdPsiIo = -1;
+  int fdStat = -1, fdMeminfo = -1, fdDiskstats = -1;
+  int fdOut = -1;
+  std::vector<std::string> disks;
+  Counters prev;
+  bool hasPrev = false;
+  // Read buffer, grown to fit /proc/diskstats, and pending output
+  std::vector<char> buf = std::vector<char>(16384);
+  std::string out;
+};
+
+// ProcessSampler.cpp
+#include <dirent.h>
+
+/**
+ * Samples /proc/[pid]/stat and /proc/[pid]/io of every process, like
+ * bootchart. Writes bootchart logs to bootchart/ while sampling, and a top-N
+ * report (processes.txt, processes.csv) plus per-process CPU counters
+ * (proctrace.json, Chrome JSON trace format) once stopped.
+ */
+class ProcessSampler : public PeriodicSampler {
+ public:
+  ProcessSampler(int intervalMs, double budgetPct, int topN)
+      : PeriodicSampler("ProcessSampler", intervalMs, budgetPct), kTopN(topN) {}
+  ~ProcessSampler() override;
+
+  // Open /proc and the bootchart logs in [dir]
+  bool open(const std::filesystem::path &dir);
+
+ protected:
+  void sample() override;
+  void finish() override;
+
+ private:
+  struct Process {
+    int pid = 0;
+    std::string comm, name;  // name is from cmdline if there is one
+    uint64_t startTicks = 0;  // starttime in stat, tells apart reused pids
+    double startMs = 0, endMs = 0;  // first and last seen
+    // utime + stime, now and when first seen
+    uint64_t cpuTicks = 0, baseTicks = 0;
+    uint64_t readBytes = 0, writeBytes = 0, baseRead = 0, baseWrite = 0;
+    // (time ms, CPU %) whenever CPU usage changed
+    std::vector<std::pair<double, float>> cpuSeries;
+    unsigned generation = 0;
+
+    double cpuMs(long ticksPerSec) const { return (cpuTicks - baseTicks) * 1000.0 / ticksPerSec; }
+  };
+
+  // Reads /proc/[pid]/[file] into buf, returns the length or -1
+  ssize_t readPidFile(int pid, const char *file);
+  bool readProcess(Process &p, double now, bool fresh);
+  void appendProcFile(std::string &out, int fd, unsigned long jiffies);
+  void flush(bool force);
+  bool writeReport();
+
+  const int kTopN;
+  const long kTicksPerSec = sysconf(_SC_CLK_TCK);
+  std::filesystem::path dir;
+  DIR *procDir = nullptr;
+  int fdStat = -1, fdDiskstats = -1;
+  int fdPsLog = -1, fdStatLog = -1, fdDiskstatsLog = -1;
+  // Pending output of the bootchart logs
+  std::string psLog, statLog, diskstatsLog;
+  std::unordered_map<int, Process> running;
+  std::vector<Process> exited;
+  unsigned generation = 0;
+  double firstMs = 0, lastMs = 0;
+  // Unexpected failures of readPidFile(), like running out of fds
+  uint64_t openFailures = 0;
+  // Read buffer, grown to fit /proc/stat and /proc/diskstats
+  std::vector<char> buf = std::vector<char>(16384);
+};
+
+// LogStore.cpp
+#include <chrono>
+
+// Extension of log store files
+#define kLogStoreExt ".logs"
+
+// Time of a logcat or kmsg timestamp in milliseconds, -1 if not parsable.
+// Logcat times count from the start of the year, kmsg times from boot.
+int64_t parseLogTimeMs(std::string_view ts);
+
+// On disk header of a log store block, followed by bloomBits / 8 bytes of bloom
+// filter and compSize bytes of zlib data
+struct LogBlockHeader {
+  uint32_t magic;
+  uint32_t rawSize, compSize, lines;
+  int64_t minTimeMs, maxTimeMs;
+  // Bit per Android log priority in the block, kernel levels are mapped onto those
+  uint32_t severityMask;
+  // Bloom filter of the tags and pids in the block, sized by their number
+  uint32_t bloomBits, bloomHashes;
+  uint32_t reserved;
+};
+
+struct LogBlockIndex {
+  uint64_t offset;  // Of the LogBlockHeader
+  LogBlockHeader header;
+};
+
+/**
+ * Writes lines to a compressed, indexed log store. Lines are grouped into
+ * zlib compressed blocks, each with a time range, the priorities in it and
+ * a bloom filter of tags and pids, so 'logger query' can skip blocks
+ * without decompressing them.
+ */
+class LogStoreWriter {
+ public:
+  ~LogStoreWriter();
+
+  bool open(const std::filesystem::path &path);
+  void append(std::string_view line);
+  // Writes the last block and the index
+  void close();
+
+ private:
+  void flushBlock();
+
+  std::string kPath;
+  int fd = -1;
+  uint64_t offset = 0, rawBytes = 0;
+  // Current block
+  std::string block, compressed;
+  uint32_t lines = 0, severityMask = 0;
+  int64_t minTimeMs = 0, maxTimeMs = 0, lastTimeMs = 0;
+  // Tag and pid hashes of the block with repeats, and the bloom filter built from them
+  std::vector<uint64_t> keys, bloom;
+  std::chrono::steady_clock::time_point blockStart;
+  std::vector<LogBlockIndex> index;
+};
+
+// 'logger query' subcommand
+int queryMain(int argc, const char **argv);
+
+// AvcAnalyze.cpp
+// 'logger analyze' subcommand
+int analyzeMain(int argc, const char **argv);
+
+// LivePublisher.cpp
+#include <thread>
+
+// Abstract UNIX socket names, boot and system log mode
+#define kLiveSocketName "bootlogger"
+#define kLiveSystemSocketName "bootlogger.system"
+
+/**
+ * Publishes captured lines to local subscribers on an abstract UNIX socket.
+ * Lines are copied once into a shared ring, and sent from there to every
+ * subscriber with its own cursor and filter, in small batches copied out so
+ * the ring is not locked while filtering and sending. Capture never waits for a
+ * subscriber: a slow one is lapped by the ring and told how many lines it
+ * lost, others are not affected.
+ *
+ * A subscriber sends one line of filters first, like
+ * "source=logcat tag=init pid=1 prio=W text=foo", or an empty line.
+ */
+class LivePublisher {
+ public:
+  explicit LivePublisher(size_t ringSize);
+  ~LivePublisher();
+
+  // Must be called before start()
+  int addSource(const std::string &name);
+  // Listen on [name] and serve until [run] is false
+  bool start(const std::string &name, std::atomic_bool *run);
+  // Publish a line of [source], from any thread
+  void publish(int source, std::string_view line);
+
+ private:
+  struct Subscriber {
+    int fd = -1;
+    // Filter
+    int source = -1, pid = -1, minSeverity = 0;
+    std::vector<std::string> tags;
+    std::string text;
+    // Byte position and line number of the next line in the ring
+    uint64_t pos = 0, seq = 0;
+    // Filter line being read, then data that could not be sent yet
+    std::string pending;
+    // Records copied out of the ring, filtered and sent without the lock
+    std::string batch;
+    bool streaming = false, blocked = false, closed = false;
+    uint64_t sent = 0, dropped = 0;
+
+    bool parseFilter(const std::string &spec, const std::vector<std::string> &sources);
+    bool matches(int source, std::string_view line) const;
+  };
+
+  void makeRoom(size_t size);
+  bool readFilter(Subscriber &sub);
+  bool send(Subscriber &sub);
+  void serve(std::atomic_bool *run);
+  void closeSubscribers(bool all);
+
+  std::vector<std::string> sources;
+  std::mutex lock;
+  std::vector<char> ring;
+  // Monotonic byte positions of the oldest and next record, line number of the oldest
+  uint64_t head = 0, tail = 0, tailSeq = 0;
+  std::atomic_bool wakePending = false;
+  int listenFd = -1, wakeFd = -1;
+  std::vector<Subscriber> subscribers;
+  std::thread thread;
+};
+
+// 'logger follow' subcommand
+int followMain(int argc, const char **argv);
+
+// AllocStats.cpp
+// Heap allocations made by the calling thread. Always 0 unless built with
+// -DLOGGER_ALLOC_STATS, which replaces the global operator new to count them.
+uint64_t getThreadAllocCount();
@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <vector>
+
+#include "LoggerInternal.h"
+
+// Regex syntax tree, only lives while a pattern is being added
+struct MultiRegex::Node {
+  enum Type {
+    EMPTY,
+    CHARS,   // One byte out of [chars]
+    CONCAT,
+    ALTERNATE,
+    REPEAT,  // [min, max] times of kids[0], max < 0 being unbounded
+    BOL,     // ^
+    EOL,     // $
+  } type = EMPTY;
+  CharSet chars;
+  std::vector<Node> kids;
+  int min = 0, max = 0;
+};
+
+// Recursive descent parser for the supported subset:
+// literals, ., [...], [^...], \w \d \s (and uppercase), ( ), (?: ), |, * + ? {m,n}, ^ $
+struct MultiRegex::Parser {
+  const std::string &pattern;
+  size_t pos = 0;
+  bool icase;
+  std::string error;
+
+  Parser(const std::string &pattern, bool icase) : pattern(pattern), icase(icase) {}
+
+  bool more() const { return pos < pattern.size(); }
+  char peek() const { return pattern[pos]; }
+
+  bool fail(const char *msg) {
+    if (error.empty())
+      error = std::string(msg) + " at offset " + std::to_string(pos);
+    return false;
+  }
+
+  void addChar(CharSet &set, unsigned char c) {
+    set.set(c);
+    if (icase && std::isalpha(c)) {
+      set.set(std::tolower(c));
+      set.set(std::toupper(c));
+    }
+  }
+
+  // \w, \d, \s and friends. Returns false if [c] is not a class
+  static bool classEscape(char c, CharSet &set) {
+    CharSet tmp;
+    switch (std::tolower(c)) {
+      case 'w':
+        for (int i = 0; i < 256; ++i)
+          if (std::isalnum(i) || i == '_') tmp.set(i);
+        break;
+      case 'd':
+        for (int i = '0'; i <= '9'; ++i) tmp.set(i);
+        break;
+      case 's':
+        for (const char s : std::string(" \t\n\r\f\v")) tmp.set(s);
+        break;
+      default:
+        return false;
+    }
+    if (std::isupper(c))
+      tmp.flip();
+    set |= tmp;
+    return true;
+  }
+
+  static char literalEscape(char c) {
+    switch (c) {
+      case 't': return '\t';
+      case 'n': return '\n';
+      case 'r': return '\r';
+      default: return c;
+    }
+  }
+
+  bool parseClass(Node &node) {
+    bool negate = false, first = true;
+    node.type = Node::CHARS;
+    ++pos; // '['
+    if (more() && peek() == '^') {
+      negate = true;
+      ++pos;
+    }
+    while (more() && (peek() != ']' || first)) {
+      unsigned char lo = peek(), hi;
+      first = false;
+      ++pos;
+      if (lo == '\\') {
+        if (!more()) return fail("Trailing backslash");
+        if (classEscape(peek(), node.chars)) {
+          ++pos;
+          continue;
+        }
+        lo = literalEscape(pattern[pos++]);
+      }
+      hi = lo;
+      if (pos + 1 < pattern.size() && peek() == '-' && pattern[pos + 1] != ']') {
+        hi = pattern[pos + 1];
+        pos += 2;
+        if (hi == '\\' && more())
+          hi = literalEscape(pattern[pos++]);
+        if (hi < lo) return fail("Invalid range");
+      }
+      for (int c = lo; c <= hi; ++c)
+        addChar(node.chars, c);
+    }
+    if (!more()) return fail("Unterminated [");
+    ++pos; // ']'
+    if (negate)
+      node.chars.flip();
+    return true;
+  }
+
+  bool parseAtom(Node &node) {
+    char c = peek();
+    switch (c) {
+      case '(': {
+        ++pos;
+        if (pattern.compare(pos, 2, "?:") == 0)
+          pos += 2;
+        if (!parseAlternate(node)) return false;
+        if (!more() || peek() != ')') return fail("Missing )");
+        ++pos;
+        return true;
+      }
+      case '[':
+        return parseClass(node);
+      case '.':
+        ++pos;
+        node.type = Node::CHARS;
+        node.chars.set();
+        node.chars.reset('\n');
+        return true;
+      case '$':
+        ++pos;
+        node.type = Node::EOL;
+        return true;
+      case '\\':
+        ++pos;
+        if (!more()) return fail("Trailing backslash");
+        node.type = Node::CHARS;
+        if (!classEscape(peek(), node.chars))
+          addChar(node.chars, literalEscape(peek()));
+        ++pos;
+        return true;
+      case '*': case '+': case '?': case '{':
+        return fail("Nothing to repeat");
+      case '^':
+        ++pos;
+        node.type = Node::BOL;
+        return true;
+      default:
+        ++pos;
+        node.type = Node::CHARS;
+        addChar(node.chars, c);
+        return true;
+    }
+  }
+
+  bool parseNumber(int &out) {
+    size_t start = pos;
+    out = 0;
+    while (more() && std::isdigit(peek()) && out < 1000)
+      out = out * 10 + (pattern[pos++] - '0');
+    return pos != start;
+  }
+
+  bool parseRepeat(Node &node) {
+    while (more()) {
+      int min, max;
+      switch (peek()) {
+        case '*': min = 0; max = -1; ++pos; break;
+        case '+': min = 1; max = -1; ++pos; break;
+        case '?': min = 0; max = 1; ++pos; break;
+        case '{': {
+          ++pos;
+          if (!parseNumber(min)) return fail("Invalid {");
+          max = min;
+          if (more() && peek() == ',') {
+            ++pos;
+            if (!parseNumber(max))
+              max = -1;
+          }
+          if (!more() || peek() != '}') return fail("Missing }");
+          ++pos;
+          if (max >= 0 && max < min) return fail("Invalid {m,n}");
+          break;
+        }
+        default:
+          return true;
+      }
+      // Non-greedy suffix does not change whether a line matches
+      if (more() && peek() == '?')
+        ++pos;
+      Node repeat;
+      repeat.type = Node::REPEAT;
+      repeat.min = min;
+      repeat.max = max;
+      repeat.kids.emplace_back(std::move(node));
+      node = std::move(repeat);
+    }
+    return true;
+  }
+
+  bool parseConcat(Node &node) {
+    node.type = Node::CONCAT;
+    while (more() && peek() != '|' && peek() != ')') {
+      Node atom;
+      if (!parseAtom(atom) || !parseRepeat(atom)) return false;
+      node.kids.emplace_back(std::move(atom));
+    }
+    return true;
+  }
+
+  bool parseAlternate(Node &node) {
+    Node first;
+    if (!parseConcat(first)) return false;
+    if (!more() || peek() != '|') {
+      node = std::move(first);
+      return true;
+    }
+    node.type = Node::ALTERNATE;
+    node.kids.emplace_back(std::move(first));
+    while (more() && peek() == '|') {
+      ++pos;
+      Node next;
+      if (!parseConcat(next)) return false;
+      node.kids.emplace_back(std::move(next));
+    }
+    return true;
+  }
+};
+
+int MultiRegex::newState(StateType type, int out, int out1) {
+  nfa.push_back({type, out, out1, -1, {}});
+  return nfa.size() - 1;
+}
+
+// Thompson construction, built backwards from the continuation state [next]
+int MultiRegex::compileNode(const Node &node, int next) {
+  switch (node.type) {
+    case Node::EMPTY:
+      return next;
+    case Node::CHARS: {
+      int s = newState(STATE_CHARS, next);
+      nfa[s].chars = node.chars;
+      return s;
+    }
+    case Node::BOL:
+      return newState(STATE_BOL, next);
+    case Node::EOL:
+      return newState(STATE_EOL, next);
+    case Node::CONCAT:
+      for (auto it = node.kids.rbegin(); it != node.kids.rend(); ++it)
+        next = compileNode(*it, next);
+      return next;
+    case Node::ALTERNATE: {
+      int s = compileNode(node.kids.back(), next);
+      for (auto it = node.kids.rbegin() + 1; it != node.kids.rend(); ++it) {
+        int alt = compileNode(*it, next);
+        s = newState(STATE_SPLIT, alt, s);
+      }
+      return s;
+    }
+    case Node::REPEAT: {
+      const Node &kid = node.kids.front();
+      int tail = next;
+      if (node.max < 0) {
+        int loop = newState(STATE_SPLIT, -1, next);
+        nfa[loop].out = compileNode(kid, loop);
+        tail = loop;
+      } else {
+        for (int i = node.min; i < node.max; ++i)
+          tail = newState(STATE_SPLIT, compileNode(kid, tail), next);
+      }
+      for (int i = 0; i < node.min; ++i)
+        tail = compileNode(kid, tail);
+      return tail;
+    }
+  }
+  __builtin_unreachable();
+}
+
+bool MultiRegex::add(const std::string &pattern, int id, bool icase, std::string *error) {
+  Parser parser(pattern, icase);
+  Node root;
+
+  if (!parser.parseAlternate(root) || parser.more()) {
+    parser.fail("Unexpected )");
+    if (error)
+      *error = parser.error;
+    return false;
+  }
+  int match = newState(STATE_MATCH);
+  nfa[match].id = id;
+  int start = compileNode(root, match);
+  // Anchored as a whole, no need to try it past the first byte. Anchors of
+  // single alternatives are left to addClosure().
+  (nfa[start].type == STATE_BOL ? anchoredStarts : floatingStarts).emplace_back(start);
+  idCount = std::max(idCount, id + 1);
+  resetCache();
+  return true;
+}
+
+void MultiRegex::addClosure(int s, std::vector<int> &set, std::vector<bool> &seen,
+                            bool atStart, bool atEnd) const {
+  // Explicit stack, patterns like (a*)* produce long epsilon chains
+  std::vector<int> stack{s};
+  while (!stack.empty()) {
+    s = stack.back();
+    stack.pop_back();
+    if (s < 0 || seen[s])
+      continue;
+    seen[s] = true;
+    if (nfa[s].type == STATE_SPLIT) {
+      stack.push_back(nfa[s].out1);
+      stack.push_back(nfa[s].out);
+    } else if (nfa[s].type == STATE_BOL) {
+      // Passes at the start of the line only, dead anywhere else
+      if (atStart)
+        stack.push_back(nfa[s].out);
+    } else if (nfa[s].type == STATE_EOL && atEnd) {
+      stack.push_back(nfa[s].out);
+    } else {
+      set.push_back(s);
+    }
+  }
+}
+
+int MultiRegex::findOrAddState(std::vector<int> &set) {
+  std::sort(set.begin(), set.end());
+  auto it = stateIndex.find(set);
+  if (it != stateIndex.end())
+    return it->second;
+  if (dfa.size() >= kMaxCachedStates) {
+    // Bound memory. Happens only with pathological patterns.
+    resetCache();
+  }
+
+  DState state;
+  state.accept.assign(wordCount(), 0);
+  state.eolAccept.assign(wordCount(), 0);
+  state.next.fill(-1);
+  for (const int s : set) {
+    if (nfa[s].type == STATE_MATCH) {
+      state.accept[nfa[s].id / 64] |= 1ULL << (nfa[s].id % 64);
+      state.accepting = true;
+    }
+  }
+  state.accepting |= eolMatches(set, false, state.eolAccept);
+  state.nfa = set;
+  dfa.emplace_back(std::move(state));
+  stateIndex.emplace(set, dfa.size() - 1);
+  return dfa.size() - 1;
+}
+
+bool MultiRegex::eolMatches(const std::vector<int> &set, bool atStart,
+                            std::vector<uint64_t> &ids) const {
+  std::vector<int> after;
+  std::vector<bool> seen(nfa.size());
+  bool any = false;
+
+  // Only one line end, so whatever follows a $ may only be more assertions
+  for (const int s : set) {
+    if (nfa[s].type == STATE_EOL)
+      addClosure(nfa[s].out, after, seen, atStart, true);
+  }
+  for (const int a : after) {
+    if (nfa[a].type == STATE_MATCH) {
+      ids[nfa[a].id / 64] |= 1ULL << (nfa[a].id % 64);
+      any = true;
+    }
+  }
+  return any;
+}
+
+int MultiRegex::step(int from, unsigned char c) {
+  std::vector<int> set;
+  std::vector<bool> seen(nfa.size());
+  // Copy, as findOrAddState() may reset the cache
+  const auto states = dfa[from].nfa;
+
+  for (const int s : states) {
+    if (nfa[s].type == STATE_CHARS && nfa[s].chars.test(c))
+      addClosure(nfa[s].out, set, seen, false, false);
+  }
+  // Unanchored patterns may start at every position
+  for (const int s : floatingStarts)
+    addClosure(s, set, seen, false, false);
+  int to = findOrAddState(set);
+  if (from < static_cast<int>(dfa.size()) && dfa[from].nfa == states)
+    dfa[from].next[c] = to;
+  return to;
+}
+
+int MultiRegex::startState() {
+  if (start < 0) {
+    std::vector<int> set;
+    std::vector<bool> seen(nfa.size());
+    for (const int s : anchoredStarts)
+      addClosure(s, set, seen, true, false);
+    for (const int s : floatingStarts)
+      addClosure(s, set, seen, true, false);
+    // The same set may be reached later in a line, where a ^ after the $
+    // no longer passes. Kept aside for empty lines.
+    emptyLineAccept.assign(wordCount(), 0);
+    eolMatches(set, true, emptyLineAccept);
+    start = findOrAddState(set);
+  }
+  return start;
+}
+
+void MultiRegex::resetCache() {
+  dfa.clear();
+  stateIndex.clear();
+  start = -1;
+}
+
+bool MultiRegex::match(std::string_view line, std::vector<uint64_t> &matched) {
+  bool any = false;
+
+  matched.assign(wordCount(), 0);
+  if (nfa.empty())
+    return false;
+  int s = startState();
+  for (const char c : line) {
+    if (dfa[s].accepting) {
+      for (size_t i = 0; i < matched.size(); ++i)
+        matched[i] |= dfa[s].accept[i];
+    }
+    int n = dfa[s].next[static_cast<unsigned char>(c)];
+    s = n >= 0 ? n : step(s, c);
+  }
+  if (line.empty()) {
+    for (size_t i = 0; i < matched.size(); ++i)
+      matched[i] |= dfa[s].accept[i] | emptyLineAccept[i];
+  } else if (dfa[s].accepting) {
+    for (size_t i = 0; i < matched.size(); ++i)
+      matched[i] |= dfa[s].accept[i] | dfa[s].eolAccept[i];
+  }
+  for (const auto w : matched)
+    any |= w != 0;
+  return any;
+}
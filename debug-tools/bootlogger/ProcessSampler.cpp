@@ -0,0 +1,325 @@
+#include <android-base/file.h>
+#include <android-base/properties.h>
+
+#include <fcntl.h>
+#include <sys/utsname.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include "LoggerInternal.h"
+
+using android::base::GetProperty;
+using android::base::WriteStringToFile;
+
+namespace fs = std::filesystem;
+
+static int openLog(const fs::path &path) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    PLOGE("Failed to open '%s'", path.c_str());
+  return fd;
+}
+
+static void writeAll(int fd, std::string &str) {
+  if (fd >= 0 && !str.empty() && write(fd, str.data(), str.size()) < 0)
+    PLOGE("Failed to write");
+  str.clear();
+}
+
+// Key/value header, as expected by pybootchartgui
+static void writeBootchartHeader(const fs::path &path) {
+  std::ostringstream ss;
+  std::string cmdline, cpu;
+  struct utsname uts {};
+  char buf[4096];
+
+  uname(&uts);
+  if (FILE *f = fopen("/proc/cmdline", "re")) {
+    if (fgets(buf, sizeof(buf), f))
+      cmdline = buf;
+    fclose(f);
+  }
+  if (!cmdline.empty() && cmdline.back() == '\n')
+    cmdline.pop_back();
+  ss << "version = Android init 0.8\n"
+     << "title = Boot chart for " << GetProperty("ro.product.model", "Android") << '\n'
+     << "system.uname = " << uts.sysname << ' ' << uts.release << ' ' << uts.version << ' '
+     << uts.machine << '\n'
+     << "system.release = " << GetProperty("ro.build.fingerprint", "") << '\n'
+     << "system.cpu = " << GetProperty("ro.soc.model", uts.machine) << " ("
+     << sysconf(_SC_NPROCESSORS_CONF) << ")\n"
+     << "system.kernel.options = " << cmdline << '\n';
+  std::string str = ss.str();
+  int fd = openLog(path);
+  writeAll(fd, str);
+  if (fd >= 0)
+    close(fd);
+}
+
+bool ProcessSampler::open(const fs::path &logDir) {
+  std::error_code ec;
+
+  dir = logDir;
+  procDir = opendir("/proc");
+  if (!procDir) {
+    PLOGE("Failed to open /proc");
+    return false;
+  }
+  fdStat = ::open("/proc/stat", O_RDONLY | O_CLOEXEC);
+  fdDiskstats = ::open("/proc/diskstats", O_RDONLY | O_CLOEXEC);
+
+  const auto kBootchart = dir / "bootchart";
+  fs::create_directories(kBootchart, ec);
+  writeBootchartHeader(kBootchart / "header");
+  fdPsLog = openLog(kBootchart / "proc_ps.log");
+  fdStatLog = openLog(kBootchart / "proc_stat.log");
+  fdDiskstatsLog = openLog(kBootchart / "proc_diskstats.log");
+  psLog.reserve(BUF_SIZE * 8);
+  return fdPsLog >= 0;
+}
+
+// Opened for each read, keeping them open would take two fds per process
+ssize_t ProcessSampler::readPidFile(int pid, const char *file) {
+  char path[32];
+
+  snprintf(path, sizeof(path), "%d/%s", pid, file);
+  int fd = openat(dirfd(procDir), path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    // Exited since readdir(), or io of another user without CAP_SYS_PTRACE,
+    // anything else drops the process from the report
+    if (errno != ENOENT && errno != ESRCH && errno != EACCES && openFailures++ == 0)
+      PLOGE("Failed to open /proc/%s", path);
+    return -1;
+  }
+  const ssize_t len = readProcFd(fd, buf.data(), buf.size());
+  close(fd);
+  return len;
+}
+
+// Process name from argv[0] without path, comm if it has no cmdline (kernel threads)
+static std::string readName(int procFd, int pid, const std::string &comm) {
+  char path[32], buf[256];
+
+  snprintf(path, sizeof(path), "%d/cmdline", pid);
+  int fd = openat(procFd, path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return comm;
+  ssize_t len = readProcFd(fd, buf, sizeof(buf));
+  close(fd);
+  if (len <= 0 || buf[0] == '\0')
+    return comm;
+  const char *base = strrchr(buf, '/');
+  return base && base[1] ? base + 1 : buf;
+}
+
+bool ProcessSampler::readProcess(Process &p, double now, bool fresh) {
+  // "pid (comm) state ppid ...", comm may have spaces and parentheses
+  if (readPidFile(p.pid, "stat") <= 0)
+    return false;
+  char *lparen = strchr(buf.data(), '(');
+  char *rparen = strrchr(buf.data(), ')');
+  if (!lparen || !rparen || rparen < lparen)
+    return false;
+
+  std::string_view comm(lparen + 1, rparen - lparen - 1);
+  // Renamed after fork, like zygote children
+  if (comm != p.comm) {
+    p.comm = comm;
+    p.name = readName(dirfd(procDir), p.pid, p.comm);
+  }
+  // utime and stime are the 11th and 12th fields after the state, starttime the 19th
+  char *pos = rparen + 3;
+  uint64_t ticks = 0, startTicks = 0;
+  for (int i = 0; i < 19; ++i) {
+    const auto v = strtoull(pos, &pos, 10);
+    if (i == 10 || i == 11)
+      ticks += v;
+    else if (i == 18)
+      startTicks = v;
+  }
+  // The pid was reused, the process seen before has exited
+  if (!fresh && startTicks != p.startTicks)
+    return false;
+  p.startTicks = startTicks;
+  psLog += std::to_string(p.pid) + " (" + p.name + ")";
+  psLog += rparen + 1;
+
+  const bool changed = fresh || ticks != p.cpuTicks;
+  if (!fresh && (changed || (!p.cpuSeries.empty() && p.cpuSeries.back().second > 0))) {
+    const double cpuMs = (ticks - p.cpuTicks) * 1000.0 / kTicksPerSec;
+    p.cpuSeries.emplace_back(now, now > lastMs ? cpuMs * 100 / (now - lastMs) : 0);
+  }
+  p.cpuTicks = ticks;
+  p.endMs = now;
+  // A process that did not run did no I/O either
+  if (changed && readPidFile(p.pid, "io") > 0) {
+    p.readBytes = findProcValue(buf.data(), "read_bytes");
+    p.writeBytes = findProcValue(buf.data(), "\nwrite_bytes");
+  }
+  if (fresh && generation == 1) {
+    // Running before sampling began, count from here
+    p.baseTicks = p.cpuTicks;
+    p.baseRead = p.readBytes;
+    p.baseWrite = p.writeBytes;
+  }
+  return true;
+}
+
+// Bootchart log block: uptime in jiffies, the file contents and an empty line
+void ProcessSampler::appendProcFile(std::string &out, int fd, unsigned long jiffies) {
+  if (readProcFile(fd, buf) <= 0)
+    return;
+  out += std::to_string(jiffies) + '\n';
+  out += buf.data();
+  out += '\n';
+}
+
+void ProcessSampler::sample() {
+  const double now = getMonotonicMs();
+  const unsigned long jiffies = now / 10;
+  struct dirent *ent;
+
+  ++generation;
+  if (generation == 1)
+    firstMs = now;
+  appendProcFile(statLog, fdStat, jiffies);
+  appendProcFile(diskstatsLog, fdDiskstats, jiffies);
+
+  psLog += std::to_string(jiffies) + '\n';
+  rewinddir(procDir);
+  while ((ent = readdir(procDir))) {
+    if (!isdigit(ent->d_name[0]))
+      continue;
+    const int pid = atoi(ent->d_name);
+    auto it = running.find(pid);
+    const bool fresh = it == running.end();
+    if (fresh) {
+      Process p;
+      p.pid = pid;
+      p.startMs = now;
+      it = running.emplace(pid, std::move(p)).first;
+    }
+    // Exited, or the pid was reused. A new process is picked up next time.
+    if (!readProcess(it->second, now, fresh)) {
+      if (!fresh)
+        exited.emplace_back(std::move(it->second));
+      running.erase(it);
+      continue;
+    }
+    it->second.generation = generation;
+  }
+  psLog += '\n';
+
+  for (auto it = running.begin(); it != running.end();) {
+    if (it->second.generation != generation) {
+      exited.emplace_back(std::move(it->second));
+      it = running.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  lastMs = now;
+  flush(false);
+}
+
+void ProcessSampler::flush(bool force) {
+  if (force || psLog.size() >= BUF_SIZE * 4) {
+    writeAll(fdPsLog, psLog);
+    writeAll(fdStatLog, statLog);
+    writeAll(fdDiskstatsLog, diskstatsLog);
+  }
+}
+
+void ProcessSampler::finish() {
+  flush(true);
+  for (auto &p : running)
+    exited.emplace_back(std::move(p.second));
+  running.clear();
+  if (openFailures > 0)
+    ALOGW("ProcessSampler: %" PRIu64 " /proc/[pid] files failed to open, those processes are "
+          "missing", openFailures);
+  writeReport();
+}
+
+bool ProcessSampler::writeReport() {
+  const long tck = kTicksPerSec;
+  const size_t kTop = std::min<size_t>(kTopN, exited.size());
+  std::ostringstream txt, csv, trace;
+  std::vector<const Process *> procs;
+  char line[256];
+
+  for (const auto &p : exited)
+    procs.emplace_back(&p);
+  auto printTop = [&](const char *title, auto key) {
+    std::sort(procs.begin(), procs.end(),
+              [&](const auto *a, const auto *b) { return key(*a) > key(*b); });
+    txt << '\n' << title << '\n';
+    snprintf(line, sizeof(line), "%7s %-32s %10s %10s %10s %10s %10s\n", "pid", "name", "cpu_ms",
+             "read_kb", "write_kb", "start_ms", "end_ms");
+    txt << line;
+    for (size_t i = 0; i < kTop && key(*procs[i]) > 0; ++i) {
+      const auto &p = *procs[i];
+      snprintf(line, sizeof(line), "%7d %-32.32s %10.0f %10" PRIu64 " %10" PRIu64 " %10.0f %10.0f\n",
+               p.pid, p.name.c_str(), p.cpuMs(tck), (p.readBytes - p.baseRead) / 1024,
+               (p.writeBytes - p.baseWrite) / 1024, p.startMs, p.endMs);
+      txt << line;
+    }
+  };
+
+  txt << "Per-process accounting over " << static_cast<int>((lastMs - firstMs) / 1000)
+      << "s, " << generation << " samples, " << exited.size() << " processes\n";
+  txt << "Processes running before the first sample count from then on\n";
+  printTop("Top by CPU time", [&](const Process &p) { return p.cpuMs(tck); });
+  printTop("Top by bytes read", [](const Process &p) { return p.readBytes - p.baseRead; });
+  printTop("Top by bytes written", [](const Process &p) { return p.writeBytes - p.baseWrite; });
+
+  csv << "pid,name,start_ms,end_ms,cpu_ms,read_kb,write_kb\n";
+  for (const auto &p : exited) {
+    snprintf(line, sizeof(line), "%d,%s,%.1f,%.1f,%.0f,%" PRIu64 ",%" PRIu64 "\n", p.pid,
+             escapeCsv(p.name).c_str(), p.startMs,
+             p.endMs, p.cpuMs(tck), (p.readBytes - p.baseRead) / 1024,
+             (p.writeBytes - p.baseWrite) / 1024);
+    csv << line;
+  }
+
+  // CPU usage counter of the top processes, can be opened by ui.perfetto.dev
+  std::sort(procs.begin(), procs.end(),
+            [&](const auto *a, const auto *b) { return a->cpuMs(tck) > b->cpuMs(tck); });
+  trace.precision(0);
+  trace << std::fixed << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  for (size_t i = 0; i < kTop; ++i) {
+    const auto &p = *procs[i];
+    trace << (i ? "," : "") << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << p.pid
+          << ",\"args\":{\"name\":\"" << escapeJson(p.name) << "\"}}";
+    trace << ",{\"name\":\"" << escapeJson(p.name) << "\",\"ph\":\"X\",\"pid\":" << p.pid
+          << ",\"tid\":" << p.pid << ",\"ts\":" << p.startMs * 1000
+          << ",\"dur\":" << (p.endMs - p.startMs) * 1000 << '}';
+    for (const auto &s : p.cpuSeries) {
+      trace << ",{\"name\":\"cpu_pct\",\"ph\":\"C\",\"pid\":" << p.pid
+            << ",\"ts\":" << s.first * 1000 << ",\"args\":{\"cpu\":" << s.second << "}}";
+    }
+  }
+  trace << "]}\n";
+
+  bool ret = true;
+  ret &= WriteStringToFile(txt.str(), (dir / "processes.txt").string());
+  ret &= WriteStringToFile(csv.str(), (dir / "processes.csv").string());
+  ret &= WriteStringToFile(trace.str(), (dir / "proctrace.json").string());
+  if (!ret)
+    PLOGE("Failed to write process report to '%s'", dir.c_str());
+  return ret;
+}
+
+ProcessSampler::~ProcessSampler() {
+  for (const int fd : {fdStat, fdDiskstats, fdPsLog, fdStatLog, fdDiskstatsLog}) {
+    if (fd >= 0)
+      close(fd);
+  }
+  if (procDir)
+    closedir(procDir);
+}
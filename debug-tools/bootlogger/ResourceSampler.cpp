@@ -0,0 +1,264 @@
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "LoggerInternal.h"
+
+namespace fs = std::filesystem;
+
+static int openProc(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    PLOGE("Failed to open '%s'", path);
+  return fd;
+}
+
+static double threadCpuUs() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+ssize_t readProcFd(int fd, char *buf, size_t size) {
+  if (fd < 0)
+    return -1;
+  ssize_t len = TEMP_FAILURE_RETRY(pread(fd, buf, size - 1, 0));
+  buf[len > 0 ? len : 0] = '\0';
+  return len;
+}
+
+ssize_t readProcFile(int fd, std::vector<char> &buf) {
+  size_t len = 0;
+
+  if (fd < 0)
+    return -1;
+  while (true) {
+    if (buf.size() - len < 2) {
+      // Stays at the size needed, so this only happens while the file grows
+      buf.resize(std::max<size_t>(buf.size() * 2, 4096));
+      ALOGD("%s: Growing buffer to %zu bytes", __func__, buf.size());
+    }
+    const ssize_t ret = TEMP_FAILURE_RETRY(pread(fd, buf.data() + len, buf.size() - len - 1, len));
+    if (ret < 0) {
+      buf[0] = '\0';
+      return -1;
+    }
+    if (ret == 0)
+      break;
+    len += ret;
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+uint64_t findProcValue(const char *from, const char *key) {
+  const char *p = strstr(from, key);
+  if (!p)
+    return 0;
+  p += strlen(key);
+  while (*p == ' ' || *p == '=' || *p == ':')
+    ++p;
+  return strtoull(p, nullptr, 10);
+}
+
+// "some avg10=0.00 avg60=0.00 avg300=0.00 total=1234\nfull ... total=123"
+void ResourceSampler::readPressure(int fd, uint64_t &some, uint64_t &full) {
+  if (readProcFd(fd, buf.data(), buf.size()) <= 0)
+    return;
+  some = findProcValue(buf.data(), "total");
+  const char *f = strstr(buf.data(), "full");
+  if (f)
+    full = findProcValue(f, "total");
+}
+
+bool ResourceSampler::open(const fs::path &dir) {
+  fdPsiCpu = openProc("/proc/pressure/cpu");
+  fdPsiMem = openProc("/proc/pressure/memory");
+  fdPsiIo = openProc("/proc/pressure/io");
+  fdStat = openProc("/proc/stat");
+  fdMeminfo = openProc("/proc/meminfo");
+  fdDiskstats = openProc("/proc/diskstats");
+
+  // Whole disks only. Partitions, device mapper, loop and zram devices
+  // would count the same I/O more than once.
+  if (readProcFile(fdDiskstats, buf) > 0) {
+    std::vector<std::string> names;
+    char *save = nullptr;
+    for (char *line = strtok_r(buf.data(), "\n", &save); line;
+         line = strtok_r(nullptr, "\n", &save)) {
+      char name[32];
+      if (sscanf(line, "%*u %*u %31s", name) == 1)
+        names.emplace_back(name);
+    }
+    for (const auto &name : names) {
+      bool partition = false;
+      for (const auto &other : names)
+        partition |= other.size() < name.size() && name.find(other) == 0;
+      if (partition || name.find("loop") == 0 || name.find("ram") == 0 ||
+          name.find("dm-") == 0 || name.find("zram") == 0)
+        continue;
+      disks.emplace_back(name);
+    }
+  }
+
+  const auto path = (dir / "resources.csv").string();
+  fdOut = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fdOut < 0) {
+    PLOGE("Failed to open '%s'", path.c_str());
+    return false;
+  }
+  out.reserve(BUF_SIZE * 2);
+  out = "time_ms,cpu_busy_pct,cpu_iowait_pct,psi_cpu_some_pct,psi_mem_some_pct,"
+        "psi_mem_full_pct,psi_io_some_pct,psi_io_full_pct,mem_available_kb,mem_cached_kb,"
+        "disk_read_kb,disk_write_kb\n";
+  return true;
+}
+
+void ResourceSampler::read(Counters &c) {
+  c.timeMs = getMonotonicMs();
+
+  readPressure(fdPsiCpu, c.psiCpuSome, c.psiCpuFull);
+  readPressure(fdPsiMem, c.psiMemSome, c.psiMemFull);
+  readPressure(fdPsiIo, c.psiIoSome, c.psiIoFull);
+
+  // Only the first line is needed, "cpu  user nice system idle iowait irq softirq steal"
+  if (readProcFd(fdStat, buf.data(), 512) > 0) {
+    uint64_t v[8] = {};
+    char *p = buf.data() + 3;
+    for (auto &x : v)
+      x = strtoull(p, &p, 10);
+    c.cpuIdle = v[3];
+    c.cpuIowait = v[4];
+    c.cpuTotal = 0;
+    for (const auto x : v)
+      c.cpuTotal += x;
+  }
+  // MemAvailable and Cached are within the first lines
+  if (readProcFd(fdMeminfo, buf.data(), 512) > 0) {
+    c.memAvailableKb = findProcValue(buf.data(), "MemAvailable");
+    c.memCachedKb = findProcValue(buf.data(), "\nCached");
+  }
+  // "major minor name reads merged sectors_read ms writes merged sectors_written ..."
+  if (readProcFile(fdDiskstats, buf) > 0) {
+    c.sectorsRead = c.sectorsWritten = 0;
+    for (char *line = buf.data(); line && *line;) {
+      char *next = strchr(line, '\n');
+      char name[32];
+      uint64_t v[7];
+      if (sscanf(line, "%*u %*u %31s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                 " %" SCNu64 " %" SCNu64, name, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+                 &v[6]) == 8 &&
+          std::find(disks.begin(), disks.end(), name) != disks.end()) {
+        c.sectorsRead += v[2];
+        c.sectorsWritten += v[6];
+      }
+      line = next ? next + 1 : nullptr;
+    }
+  }
+}
+
+void ResourceSampler::writeSample(const Counters &prev, const Counters &cur) {
+  char line[256];
+  const double intervalUs = (cur.timeMs - prev.timeMs) * 1000;
+  // Counters may go backwards, like /proc/stat on CPU hotplug
+  auto delta = [](uint64_t c, uint64_t p) { return c > p ? static_cast<double>(c - p) : 0.0; };
+  auto pct = [](double part, double whole) { return whole > 0 ? part * 100 / whole : 0; };
+  const double jiffies = delta(cur.cpuTotal, prev.cpuTotal);
+  const double idle = delta(cur.cpuIdle, prev.cpuIdle);
+  const double iowait = delta(cur.cpuIowait, prev.cpuIowait);
+
+  snprintf(line, sizeof(line),
+           "%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+           ",%" PRIu64 "\n",
+           cur.timeMs, pct(jiffies - idle - iowait, jiffies), pct(iowait, jiffies),
+           pct(delta(cur.psiCpuSome, prev.psiCpuSome), intervalUs),
+           pct(delta(cur.psiMemSome, prev.psiMemSome), intervalUs),
+           pct(delta(cur.psiMemFull, prev.psiMemFull), intervalUs),
+           pct(delta(cur.psiIoSome, prev.psiIoSome), intervalUs),
+           pct(delta(cur.psiIoFull, prev.psiIoFull), intervalUs),
+           cur.memAvailableKb, cur.memCachedKb,
+           static_cast<uint64_t>(delta(cur.sectorsRead, prev.sectorsRead)) / 2,
+           static_cast<uint64_t>(delta(cur.sectorsWritten, prev.sectorsWritten)) / 2);
+  out += line;
+  // Batch writes, samples are small
+  if (out.size() >= BUF_SIZE)
+    flush();
+}
+
+void ResourceSampler::flush() {
+  if (!out.empty() && fdOut >= 0) {
+    if (write(fdOut, out.data(), out.size()) < 0)
+      PLOGE("Failed to write samples");
+    out.clear();
+  }
+}
+
+void ResourceSampler::sample() {
+  Counters cur;
+
+  read(cur);
+  if (hasPrev)
+    writeSample(prev, cur);
+  prev = cur;
+  hasPrev = true;
+}
+
+void ResourceSampler::finish() {
+  flush();
+}
+
+void PeriodicSampler::run(std::atomic_bool *run) {
+  using namespace std::chrono;
+  auto interval = milliseconds(kIntervalMs);
+  auto next = steady_clock::now();
+  double overheadUs = 0, windowUs = 0;
+  int samples = 0, windowSamples = 0;
+
+  ALOGI("%s: Sampling every %dms, budget %.1f%% CPU", kName, kIntervalMs, kBudgetPct);
+  while (*run) {
+    const double start = threadCpuUs();
+    sample();
+    const double spent = threadCpuUs() - start;
+    ++samples;
+    overheadUs += spent;
+    windowUs += spent;
+
+    // Check own cost every 10 samples, back off if over the budget
+    if (++windowSamples == 10) {
+      const double pct = windowUs * 100 / (windowSamples * interval.count() * 1000.0);
+      if (pct > kBudgetPct && interval < seconds(5)) {
+        interval *= 2;
+        ALOGW("%s: Overhead %.2f%% over budget, interval now %lldms", kName, pct,
+              static_cast<long long>(interval.count()));
+      }
+      windowSamples = 0;
+      windowUs = 0;
+    }
+
+    next += interval;
+    // Sleep in slices, to notice stop requests soon
+    while (*run && steady_clock::now() < next)
+      std::this_thread::sleep_for(std::min<steady_clock::duration>(
+          next - steady_clock::now(), milliseconds(100)));
+  }
+  finish();
+  if (samples > 0) {
+    ALOGI("%s: %d samples, %.1fus per sample, last interval %lldms", kName, samples,
+          overheadUs / samples, static_cast<long long>(interval.count()));
+  }
+}
+
+ResourceSampler::~ResourceSampler() {
+  for (const int fd : {fdPsiCpu, fdPsiMem, fdPsiIo, fdStat, fdMeminfo, fdDiskstats, fdOut}) {
+    if (fd >= 0)
+      close(fd);
+  }
+}
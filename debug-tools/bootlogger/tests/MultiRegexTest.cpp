@@ -0,0 +1,155 @@
+// Checks MultiRegex against std::regex (ECMAScript) with random patterns of
+// the supported subset and random lines, all patterns sharing one automaton.
+//
+// Usage: logger_multiregex_test [iterations] [seed]
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "../LoggerInternal.h"
+
+namespace {
+
+// Small alphabet, so that random lines actually hit the patterns
+constexpr char kAlphabet[] = "ab1 ";
+
+struct Case {
+  const char *pattern;
+  const char *line;
+};
+
+// Found to differ before, kept as is
+const Case kRegressions[] = {
+    {"^a|ba*", "1bbb"},
+    {"^a|b", "b"},
+    {"(^a|b)c", "xbc"},
+    {"a|^b", "ab"},
+    {"$$", "ab"},
+    {"a$$", "ba"},
+    {"$^", ""},
+    {"$^", "a"},
+    {"(a|$)b", "ab"},
+    {"x^a", "xa"},
+    {"(^)*a", "ba"},
+};
+
+class Generator {
+ public:
+  explicit Generator(uint32_t seed) : rng(seed) {}
+
+  std::string pattern(int depth = 0) {
+    std::string out = concat(depth);
+    while (chance(depth ? 0.15 : 0.3))
+      out += "|" + concat(depth);
+    return out;
+  }
+
+  std::string line() {
+    std::string out;
+    const int len = pick(0, 8);
+    for (int i = 0; i < len; ++i)
+      out += kAlphabet[pick(0, sizeof(kAlphabet) - 2)];
+    return out;
+  }
+
+ private:
+  std::string concat(int depth) {
+    std::string out;
+    const int len = pick(0, 4);
+    for (int i = 0; i < len; ++i)
+      out += atom(depth);
+    return out;
+  }
+
+  std::string atom(int depth) {
+    switch (pick(0, 9)) {
+      case 0:
+        return "^";
+      case 1:
+        return "$";
+      case 2:
+        if (depth < 3)
+          return repeat("(" + pattern(depth + 1) + ")");
+        [[fallthrough]];
+      case 3:
+        return repeat(pick(0, 1) ? "[ab]" : "[^a]");
+      case 4:
+        return repeat(pick(0, 1) ? "." : "\\d");
+      default:
+        return repeat(std::string(1, kAlphabet[pick(0, 2)]));
+    }
+  }
+
+  std::string repeat(std::string atom) {
+    static const char *const kRepeats[] = {"*", "+", "?", "{2}", "{1,2}", "{0,}"};
+    if (chance(0.3))
+      atom += kRepeats[pick(0, 5)];
+    return atom;
+  }
+
+  int pick(int lo, int hi) { return std::uniform_int_distribution<>(lo, hi)(rng); }
+  bool chance(double p) { return std::uniform_real_distribution<>(0, 1)(rng) < p; }
+
+  std::mt19937 rng;
+};
+
+bool check(MultiRegex &multi, const std::vector<std::string> &patterns,
+           const std::vector<std::regex> &regexes, const std::string &line) {
+  std::vector<uint64_t> matched;
+  bool ok = true;
+
+  multi.match(line, matched);
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    const bool expect = std::regex_search(line, regexes[i]);
+    if (MultiRegex::isSet(matched, i) != expect) {
+      fprintf(stderr, "pattern '%s' line '%s': got %d, std::regex %d\n", patterns[i].c_str(),
+              line.c_str(), !expect, expect);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const int iterations = argc > 1 ? atoi(argv[1]) : 2000;
+  const uint32_t seed = argc > 2 ? strtoul(argv[2], nullptr, 0) : 1;
+  Generator gen(seed);
+  int failures = 0;
+
+  for (const auto &c : kRegressions) {
+    MultiRegex multi;
+    std::string error;
+    if (!multi.add(c.pattern, 0, false, &error)) {
+      fprintf(stderr, "pattern '%s' rejected: %s\n", c.pattern, error.c_str());
+      ++failures;
+      continue;
+    }
+    failures += !check(multi, {c.pattern}, {std::regex(c.pattern)}, c.line);
+  }
+
+  for (int i = 0; i < iterations; ++i) {
+    MultiRegex multi;
+    std::vector<std::string> patterns;
+    std::vector<std::regex> regexes;
+    // Several patterns per automaton, as filters are compiled together
+    for (int p = 0; p < 4; ++p) {
+      patterns.emplace_back(gen.pattern());
+      regexes.emplace_back(patterns.back());
+      std::string error;
+      if (!multi.add(patterns.back(), p, false, &error)) {
+        fprintf(stderr, "pattern '%s' rejected: %s\n", patterns.back().c_str(), error.c_str());
+        ++failures;
+      }
+    }
+    for (int l = 0; l < 16; ++l)
+      failures += !check(multi, patterns, regexes, gen.line());
+  }
+  printf("%d iteration(s), seed %u: %d failure(s)\n", iterations, seed, failures);
+  return failures ? 1 : 0;
+}